@@ -3,7 +3,29 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Most sectors in a chain of merged requests. */
+#define BLOCK_MERGE_MAX 256
+
+/* How long a request may wait before the deadline scheduler
+   serves it ahead of the sweep.  Reads are waited on, writes
+   usually are not, so reads expire sooner. */
+#define READ_EXPIRE (TIMER_FREQ / 10)
+#define WRITE_EXPIRE (TIMER_FREQ)
+
+/* An I/O scheduler.  SELECT picks the pending request of BLOCK
+   to dispatch next.  A null SELECT means no scheduling: requests
+   go straight to the driver. */
+struct io_scheduler
+  {
+    const char *name;
+    struct block_request *(*select) (struct block *);
+  };
 
 /* A block device. */
 struct block
@@ -19,6 +41,24 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* I/O scheduling, protected by disabling interrupts. */
+    const struct io_scheduler *sched;   /* Scheduler in use. */
+    struct list sched_queue;            /* Pending requests by sector. */
+    block_sector_t sched_pos;           /* Sector after last dispatch. */
+    unsigned queue_depth;               /* Most requests the driver holds. */
+    unsigned in_flight;                 /* Requests the driver holds. */
+    unsigned pending;                   /* Requests not yet completed. */
+
+    /* Request statistics, protected by disabling interrupts. */
+    unsigned long long request_cnt;     /* Requests arrived. */
+    unsigned long long merge_cnt;       /* Requests merged into others. */
+    unsigned long long depth_sum;       /* Sum of PENDING at each arrival. */
+    unsigned max_depth;                 /* Largest PENDING seen. */
+    unsigned long long complete_cnt;    /* Requests completed. */
+    uint64_t latency_sum;               /* Cycles, submission to completion. */
+    uint64_t latency_max;               /* Slowest request, in cycles. */
+    uint64_t latency_hist[BLOCK_LATENCY_BUCKETS];   /* By log2 cycles. */
   };
 
 /* List of all block devices. */
@@ -29,6 +69,36 @@ static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
 
+static struct block_request *cscan_select (struct block *);
+static struct block_request *deadline_select (struct block *);
+
+/* Available I/O schedulers. */
+static const struct io_scheduler schedulers[] =
+  {
+    {"none", NULL},
+    {"cscan", cscan_select},
+    {"deadline", deadline_select},
+  };
+#define SCHEDULER_CNT (sizeof schedulers / sizeof *schedulers)
+
+/* Scheduler given to newly registered devices. */
+static const struct io_scheduler *default_sched = &schedulers[2];
+
+static void sched_add (struct block *, struct block_request *);
+static void sched_dispatch (struct block *);
+
+static void count_arrival (struct block *);
+static void count_completion (struct block *, uint64_t latency);
+
+/* Returns the CPU's time stamp counter, which counts cycles. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Returns a human-readable name for the given block device
    TYPE. */
 const char *
@@ -120,9 +190,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +201,445 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER, a user virtual address, a page at a time through a
+   kernel bounce page: to BLOCK if WRITE, otherwise from it.
+   Drivers may touch a request's buffer from an interrupt handler,
+   when another process's page directory may be active, or hand
+   its physical address to the device, so user buffers never reach
+   them directly.  Falls back to a sector at a time through the
+   stack if no page is free. */
+static void
+bounce (struct block *block, bool write, block_sector_t sector,
+        size_t cnt, uint8_t *buffer)
+{
+  uint8_t sector_buffer[BLOCK_SECTOR_SIZE];
+  uint8_t *page = palloc_get_page (0);
+  size_t chunk = page != NULL ? PGSIZE / BLOCK_SECTOR_SIZE : 1;
+  uint8_t *bounce_buffer = page != NULL ? page : sector_buffer;
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < chunk ? cnt : chunk;
+      size_t size = n * BLOCK_SECTOR_SIZE;
+
+      if (write)
+        {
+          memcpy (bounce_buffer, buffer, size);
+          block_write_multiple (block, sector, n, bounce_buffer);
+        }
+      else
+        {
+          block_read_multiple (block, sector, n, bounce_buffer);
+          memcpy (buffer, bounce_buffer, size);
+        }
+      sector += n;
+      cnt -= n;
+      buffer += size;
+    }
+  palloc_free_page (page);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  The request goes through BLOCK's I/O scheduler, so
+   concurrent callers are served in sweep order.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     size_t cnt, void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  if (!is_kernel_vaddr (buffer))
+    {
+      bounce (block, false, sector, cnt, buffer);
+      return;
+    }
+  block_request_init (&r, false, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.  The request goes through BLOCK's I/O scheduler.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  if (!is_kernel_vaddr (buffer))
+    {
+      bounce (block, true, sector, cnt, (void *) buffer);
+      return;
+    }
+  block_request_init (&r, true, sector, cnt, (void *) buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Initializes R as a request to transfer CNT sectors starting at
+   SECTOR between a block device and BUFFER, which must hold CNT
+   * BLOCK_SECTOR_SIZE bytes: to the device if WRITE, otherwise
+   from it.  If COMPLETE is non-null, it is called with R and AUX
+   when the transfer finishes; otherwise, use block_wait(). */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    void (*complete) (struct block_request *, void *),
+                    void *aux)
+{
+  ASSERT (r != NULL);
+  ASSERT (cnt > 0);
+
+  r->write = write;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->complete = complete;
+  r->aux = aux;
+  r->dev_sector = sector;
+  r->block = NULL;
+  r->dev_cnt = cnt;
+  r->merged = NULL;
+  r->dev_block = NULL;
+  sema_init (&r->done, 0);
+}
+
+/* Starts request R on BLOCK and returns without waiting for it
+   to finish. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  enum intr_level old_level;
+
+  r->block = block;
+  r->submit_time = rdtsc ();
+  old_level = intr_disable ();
+  count_arrival (block);
+  intr_set_level (old_level);
+
+  r->dev_sector = r->sector;
+  block_forward (block, r);
+}
+
+/* Waits for request R, which must not have a completion
+   function, to finish. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->complete == NULL);
+  sema_down (&r->done);
+}
+
+/* Passes request R, whose DEV_SECTOR has been set relative to
+   BLOCK, to BLOCK's I/O scheduler, which passes it on to BLOCK's
+   driver in due course.  Used by block_submit() and by drivers
+   layered on top of other block devices. */
+void
+block_forward (struct block *block, struct block_request *r)
+{
+  check_sector (block, r->dev_sector);
+  check_sector (block, r->dev_sector + r->cnt - 1);
+  if (r->write)
+    {
+      ASSERT (block->type != BLOCK_FOREIGN);
+      block->write_cnt += r->cnt;
+    }
+  else
+    block->read_cnt += r->cnt;
+
+  if (block->ops->submit != NULL && block->sched->select != NULL)
+    {
+      enum intr_level old_level = intr_disable ();
+      sched_add (block, r);
+      sched_dispatch (block);
+      intr_set_level (old_level);
+    }
+  else if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, r);
+  else
+    {
+      /* No queue: do the transfer here and now. */
+      const struct block_operations *ops = block->ops;
+      uint8_t *buffer = r->buffer;
+      size_t i;
+
+      if (r->write && ops->write_multiple != NULL)
+        ops->write_multiple (block->aux, r->dev_sector, r->cnt, buffer);
+      else if (!r->write && ops->read_multiple != NULL)
+        ops->read_multiple (block->aux, r->dev_sector, r->cnt, buffer);
+      else
+        for (i = 0; i < r->cnt; i++)
+          {
+            uint8_t *sector = buffer + i * BLOCK_SECTOR_SIZE;
+            if (r->write)
+              ops->write (block->aux, r->dev_sector + i, sector);
+            else
+              ops->read (block->aux, r->dev_sector + i, sector);
+          }
+      block_complete (r);
+    }
+}
+
+/* Returns the address of the data for sector IDX, counting from
+   DEV_SECTOR, of request R and the requests merged into it. */
+void *
+block_request_buffer (const struct block_request *r, size_t idx)
+{
+  ASSERT (idx < r->dev_cnt);
+
+  while (idx >= r->cnt)
+    {
+      idx -= r->cnt;
+      r = r->merged;
+    }
+  return (uint8_t *) r->buffer + idx * BLOCK_SECTOR_SIZE;
+}
+
+/* Called by a driver when request R, and so every request merged
+   into it, has finished.  Records their latencies and lets R's
+   device scheduler dispatch another request.  May be called from
+   an interrupt handler. */
+void
+block_complete (struct block_request *r)
+{
+  struct block *block = r->dev_block;
+  uint64_t now = rdtsc ();
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  while (r != NULL)
+    {
+      /* R may be freed by its completion function. */
+      struct block_request *next = r->merged;
+      uint64_t latency = now - r->submit_time;
+
+      if (r->block != NULL)
+        count_completion (r->block, latency);
+      if (block != NULL && block != r->block)
+        count_completion (block, latency);
+      if (r->complete != NULL)
+        r->complete (r, r->aux);
+      else
+        sema_up (&r->done);
+      r = next;
+    }
+  if (block != NULL)
+    {
+      block->in_flight--;
+      sched_dispatch (block);
+    }
+  intr_set_level (old_level);
+}
+
+/* Sets BLOCK's I/O scheduler to the one called NAME: "none",
+   "cscan" or "deadline".  Returns true if successful, false if
+   there is no such scheduler.  Only takes effect for devices
+   whose drivers accept asynchronous requests. */
+bool
+block_set_scheduler (struct block *block, const char *name)
+{
+  enum intr_level old_level;
+  size_t i;
+
+  for (i = 0; i < SCHEDULER_CNT; i++)
+    if (!strcmp (name, schedulers[i].name))
+      {
+        /* Switching away from a queue needs it drained first. */
+        old_level = intr_disable ();
+        ASSERT (list_empty (&block->sched_queue));
+        block->sched = &schedulers[i];
+        intr_set_level (old_level);
+        return true;
+      }
+  return false;
+}
+
+/* Makes devices registered from now on use the I/O scheduler
+   called NAME.  Returns true if successful, false if there is no
+   such scheduler. */
+bool
+block_set_default_scheduler (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < SCHEDULER_CNT; i++)
+    if (!strcmp (name, schedulers[i].name))
+      {
+        default_sched = &schedulers[i];
+        return true;
+      }
+  return false;
+}
+
+/* Adds R to BLOCK's scheduler queue, which is kept in sector
+   order.  If R continues or precedes a queued request in the
+   same direction, merges the two instead, so that the driver can
+   move both with a single command. */
+static void
+sched_add (struct block *block, struct block_request *r)
+{
+  struct list_elem *pos = list_end (&block->sched_queue);
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  r->dev_block = block;
+  r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+  if (block != r->block)
+    count_arrival (block);
+
+  for (e = list_begin (&block->sched_queue);
+       e != list_end (&block->sched_queue); e = list_next (e))
+    {
+      struct block_request *q = list_entry (e, struct block_request, elem);
+
+      if (q->write == r->write && q->dev_cnt + r->dev_cnt <= BLOCK_MERGE_MAX)
+        {
+          if (q->dev_sector + q->dev_cnt == r->dev_sector)
+            {
+              /* Back merge: R follows Q. */
+              struct block_request *tail = q;
+              while (tail->merged != NULL)
+                tail = tail->merged;
+              tail->merged = r;
+              q->dev_cnt += r->dev_cnt;
+              block->merge_cnt++;
+              return;
+            }
+          if (r->dev_sector + r->dev_cnt == q->dev_sector)
+            {
+              /* Front merge: R precedes Q, and takes its place. */
+              struct block_request *tail = r;
+              while (tail->merged != NULL)
+                tail = tail->merged;
+              tail->merged = q;
+              r->dev_cnt += q->dev_cnt;
+              if (q->deadline < r->deadline)
+                r->deadline = q->deadline;
+              list_insert (e, &r->elem);
+              list_remove (e);
+              block->merge_cnt++;
+              return;
+            }
+        }
+      if (pos == list_end (&block->sched_queue)
+          && q->dev_sector > r->dev_sector)
+        pos = e;
+    }
+  list_insert (pos, &r->elem);
+}
+
+/* Hands requests from BLOCK's scheduler queue to its driver, in
+   the order the scheduler picks, until the driver holds its
+   queue depth of them. */
+static void
+sched_dispatch (struct block *block)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (block->in_flight < block->queue_depth
+         && !list_empty (&block->sched_queue))
+    {
+      struct block_request *r = block->sched->select (block);
+
+      list_remove (&r->elem);
+      block->sched_pos = r->dev_sector + r->dev_cnt;
+      block->in_flight++;
+      block->ops->submit (block->aux, r);
+    }
+}
+
+/* Counts the arrival of a request at BLOCK, either submitted to
+   it or passed down to it by a layered device. */
+static void
+count_arrival (struct block *block)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  block->request_cnt++;
+  block->pending++;
+  block->depth_sum += block->pending;
+  if (block->pending > block->max_depth)
+    block->max_depth = block->pending;
+}
+
+/* Counts the completion of a request at BLOCK that took LATENCY
+   cycles. */
+static void
+count_completion (struct block *block, uint64_t latency)
+{
+  int bucket;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  block->pending--;
+  block->complete_cnt++;
+  block->latency_sum += latency;
+  if (latency > block->latency_max)
+    block->latency_max = latency;
+
+  for (bucket = 0; bucket < BLOCK_LATENCY_BUCKETS - 1; bucket++)
+    if ((latency >> (bucket + 1)) == 0)
+      break;
+  block->latency_hist[bucket]++;
+}
+
+/* C-SCAN elevator: serves requests in increasing sector order
+   from where the last one ended, then jumps back to the lowest
+   sector and sweeps again. */
+static struct block_request *
+cscan_select (struct block *block)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&block->sched_queue);
+       e != list_end (&block->sched_queue); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->dev_sector >= block->sched_pos)
+        return r;
+    }
+  return list_entry (list_front (&block->sched_queue),
+                     struct block_request, elem);
+}
+
+/* Deadline: like C-SCAN, except that a request that has waited
+   past its deadline goes first, preferring reads to writes and
+   then the earliest deadline.  The sweep resumes from there. */
+static struct block_request *
+deadline_select (struct block *block)
+{
+  struct block_request *expired = NULL;
+  int64_t now = timer_ticks ();
+  struct list_elem *e;
+
+  for (e = list_begin (&block->sched_queue);
+       e != list_end (&block->sched_queue); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->deadline > now)
+        continue;
+      if (expired == NULL
+          || (expired->write && !r->write)
+          || (expired->write == r->write && r->deadline < expired->deadline))
+        expired = r;
+    }
+  return expired != NULL ? expired : cscan_select (block);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -164,6 +667,7 @@ block_type (struct block *block)
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -176,19 +680,91 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      unsigned long long depth;
+      int bucket;
+
+      if (block->complete_cnt == 0)
+        continue;
+
+      depth = block->depth_sum * 10 / block->request_cnt;
+      printf ("%s: %s scheduler, %llu requests, %llu merges, "
+              "queue depth %llu.%llu avg, %u max\n",
+              block->name, block->sched->name, block->request_cnt,
+              block->merge_cnt, depth / 10, depth % 10, block->max_depth);
+      printf ("%s: latency %llu cycles avg, %llu max; log2 histogram:",
+              block->name,
+              (unsigned long long) (block->latency_sum / block->complete_cnt),
+              (unsigned long long) block->latency_max);
+      for (bucket = 0; bucket < BLOCK_LATENCY_BUCKETS; bucket++)
+        if (block->latency_hist[bucket] != 0)
+          printf (" %d:%llu", bucket,
+                  (unsigned long long) block->latency_hist[bucket]);
+      printf ("\n");
+    }
+}
+
+/* Copies the statistics of the block device called NAME, or
+   failing that of the device with the role called NAME (e.g.
+   "filesys"), into *STATS.  Returns true if successful, false
+   if there is no such device. */
+bool
+block_get_stats (const char *name, struct block_stats *stats)
+{
+  struct block *block = block_get_by_name (name);
+  enum intr_level old_level;
+  int role;
+
+  for (role = 0; block == NULL && role < BLOCK_ROLE_CNT; role++)
+    if (!strcmp (name, block_type_name (role)))
+      block = block_by_role[role];
+  if (block == NULL)
+    return false;
+
+  old_level = intr_disable ();
+  stats->read_cnt = block->read_cnt;
+  stats->write_cnt = block->write_cnt;
+  stats->read_bytes = block->read_cnt * BLOCK_SECTOR_SIZE;
+  stats->write_bytes = block->write_cnt * BLOCK_SECTOR_SIZE;
+  stats->requests = block->complete_cnt;
+  stats->merges = block->merge_cnt;
+  stats->latency_sum = block->latency_sum;
+  stats->latency_max = block->latency_max;
+  stats->queue_depth = block->pending;
+  stats->max_queue_depth = block->max_depth;
+  memcpy (stats->latency_hist, block->latency_hist,
+          sizeof stats->latency_hist);
+  intr_set_level (old_level);
+  return true;
 }
 
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
    be provided, as well as the it operation functions OPS, which
-   will be passed AUX in each function call. */
+   will be passed AUX in each function call.
+
+   QUEUE_DEPTH is the most requests the scheduler hands the
+   driver's submit function at once.  A device that can only carry
+   out one request at a time should pass 1, so that the scheduler
+   rather than the driver picks the order of everything else; one
+   with a deeper hardware queue should pass about as many requests
+   as that queue holds. */
 struct block *
 block_register (const char *name, enum block_type type,
                 const char *extra_info, block_sector_t size,
+                unsigned queue_depth,
                 const struct block_operations *ops, void *aux)
 {
-  struct block *block = malloc (sizeof *block);
+  struct block *block;
+
+  ASSERT (queue_depth > 0);
+
+  block = malloc (sizeof *block);
   if (block == NULL)
     PANIC ("Failed to allocate memory for block device descriptor");
 
@@ -200,6 +776,20 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->sched = default_sched;
+  list_init (&block->sched_queue);
+  block->sched_pos = 0;
+  block->queue_depth = queue_depth;
+  block->in_flight = 0;
+  block->pending = 0;
+  block->request_cnt = 0;
+  block->merge_cnt = 0;
+  block->depth_sum = 0;
+  block->max_depth = 0;
+  block->complete_cnt = 0;
+  block->latency_sum = 0;
+  block->latency_max = 0;
+  memset (block->latency_hist, 0, sizeof block->latency_hist);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -1,8 +1,12 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <block-stats.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,22 +57,90 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* An asynchronous transfer of CNT consecutive sectors.
+
+   The submitter fills in the public members with
+   block_request_init() and passes the request to block_submit(),
+   which returns at once.  When the transfer finishes, the block
+   layer calls COMPLETE, if it is non-null, or else ups DONE so
+   that block_wait() returns.  COMPLETE may be called in an
+   interrupt handler, so it must not sleep.  The request must
+   stay in place, untouched, until then. */
+struct block_request
+  {
+    bool write;                 /* Write to the device, or read? */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    void (*complete) (struct block_request *, void *aux);
+    void *aux;                  /* Passed to COMPLETE. */
+
+    /* Owned by the block layer and drivers. */
+    struct block *block;        /* Device submitted to. */
+    uint64_t submit_time;       /* Time stamp counter at submission. */
+    block_sector_t dev_sector;  /* SECTOR on the device being driven. */
+    size_t dev_cnt;             /* Sectors in this request and MERGED. */
+    struct block_request *merged;   /* Request for the sectors following
+                                       these, merged into this one. */
+    struct block *dev_block;    /* Scheduled device, or null. */
+    int64_t deadline;           /* Timer tick by which to dispatch. */
+    struct list_elem elem;      /* Element in a scheduler or driver queue. */
+    struct semaphore done;      /* Up'd on completion if COMPLETE is null. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer,
+                         void (*complete) (struct block_request *, void *),
+                         void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
+/* I/O scheduling. */
+bool block_set_scheduler (struct block *, const char *name);
+bool block_set_default_scheduler (const char *name);
+
 /* Statistics. */
 void block_print_stats (void);
+bool block_get_stats (const char *name, struct block_stats *);
 
 /* Lower-level interface to block device drivers. */
 
+/* READ_MULTIPLE and WRITE_MULTIPLE transfer CNT consecutive
+   sectors at once.  They are optional: if null, the block layer
+   transfers one sector at a time with READ and WRITE instead.
+
+   SUBMIT queues a block_request, which covers DEV_CNT sectors
+   starting at DEV_SECTOR, and returns without waiting.  The I/O
+   scheduler may have merged requests for the sectors that follow
+   into it, so the data for sector I of the transfer is at
+   block_request_buffer (R, I).  The driver calls
+   block_complete() on the request when the transfer is done, in
+   an interrupt handler if it likes.  SUBMIT is also optional: if
+   null, the block layer performs the transfer synchronously in
+   the submitter's context, without scheduling. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
+                              unsigned queue_depth,
                               const struct block_operations *, void *aux);
+void block_forward (struct block *, struct block_request *);
+void *block_request_buffer (const struct block_request *, size_t idx);
+void block_complete (struct block_request *);
 
 #endif /* devices/block.h */
@@ -1,14 +1,19 @@
 #include "devices/ide.h"
 #include <ctype.h>
 #include <debug.h>
+#include <list.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -30,10 +35,25 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses, per [SFF-8038i].  Only valid
+   if the channel's bm_base is nonzero. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus Master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk into memory. */
+
+/* Bus Master Status Register bits. */
+#define BM_STA_INTR 0x04        /* Interrupt (write 1 to clear). */
+#define BM_STA_ERR 0x02         /* Error (write 1 to clear). */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +69,12 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors one READ SECTOR or WRITE SECTOR command can move.
+   A sector count register value of 0 means this many. */
+#define MAX_SECTORS_PER_COMMAND 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,8 +83,22 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool dma;                   /* Use bus-master DMA for transfers? */
+    struct list queue;          /* Pending block_requests. */
   };
 
+/* A physical region descriptor, one entry in the table that
+   tells the bus master where in physical memory a DMA transfer
+   goes.  A region may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical base address. */
+    uint16_t size;              /* Byte count, 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+
 /* An ATA channel (aka controller).
    Each channel can control up to two disks. */
 struct channel
@@ -66,12 +106,22 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus master I/O port, 0 if no DMA. */
+    struct prd *prd_table;      /* Page holding the PRD table. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    /* Request in progress.  These members and the devices' queues
+       are protected by disabling interrupts. */
+    struct block_request *active;       /* Current request, or null. */
+    struct ata_disk *active_disk;       /* Disk ACTIVE is for. */
+    size_t done;                /* Sectors of ACTIVE transferred so far. */
+    size_t cmd_end;             /* DONE when the current command ends. */
+    bool cmd_dma;               /* Is the current command using DMA? */
+    int next_dev;               /* Device whose queue to try first. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -85,13 +135,23 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
+static void issue_command (struct channel *, uint8_t command);
 static void issue_pio_command (struct channel *, uint8_t command);
+static bool build_prd_table (struct channel *, const struct block_request *,
+                             size_t first, size_t cnt);
+static void dma_start (struct ata_disk *, block_sector_t, size_t cnt,
+                       bool read);
+static bool dma_finish (struct channel *);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
+static void start_request (struct channel *);
+static void start_command (struct channel *);
+static void continue_request (struct channel *);
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static bool poll_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
@@ -101,8 +161,21 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void)
 {
+  struct pci_device pci;
+  uint16_t bm_base = 0;
   size_t chan_no;
 
+  /* Find the bus master registers of a PCI IDE controller, such
+     as the PIIX that QEMU emulates.  BAR4 holds 16 ports: 8 for
+     the primary channel, then 8 for the secondary.  Without them
+     we fall back to PIO for everything. */
+  if (pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pci))
+    {
+      bm_base = pci_io_base (&pci, 4);
+      if (bm_base != 0)
+        pci_enable_master (&pci);
+    }
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -123,9 +196,19 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      c->bm_base = 0;
+      c->prd_table = NULL;
+      if (bm_base != 0)
+        {
+          c->prd_table = palloc_get_page (0);
+          if (c->prd_table != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->active = NULL;
+      c->active_disk = NULL;
+      c->next_dev = 0;
 
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +219,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->dma = false;
+          list_init (&d->queue);
         }
 
       /* Register interrupt handler. */
@@ -284,10 +369,12 @@ identify_ata_device (struct ata_disk *d)
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & (1 << 8)) != 0;
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -303,8 +390,9 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
-  /* Register. */
-  block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
+  /* Register.  The channel carries out one command at a time, so
+     the scheduler hands the driver one request at a time. */
+  block = block_register (d->name, BLOCK_RAW, extra_info, capacity, 1,
                           &ide_operations, d);
   partition_scan (block);
 }
@@ -337,6 +425,53 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Queues request R, whose DEV_SECTOR is relative to disk D, and
+   starts it right away if the channel is idle.  The interrupt
+   handler carries the request out and calls block_complete()
+   at the end. */
+static void
+ide_submit (void *d_, struct block_request *r)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  list_push_back (&d->queue, &r->elem);
+  if (c->active == NULL)
+    start_request (c);
+  intr_set_level (old_level);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes, by
+   queuing a request and waiting for it. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffer)
+{
+  struct block_request r;
+
+  block_request_init (&r, false, sec_no, cnt, buffer, NULL, NULL);
+  ide_submit (d_, &r);
+  block_wait (&r);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, by queuing a
+   request and waiting for it.  Returns after the disk has
+   acknowledged receiving all of the data. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer)
+{
+  struct block_request r;
+
+  block_request_init (&r, true, sec_no, cnt, (void *) buffer, NULL, NULL);
+  ide_submit (d_, &r);
+  block_wait (&r);
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
@@ -344,16 +479,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multiple (d_, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -364,36 +490,166 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ide_write_multiple (d_, sec_no, 1, buffer);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    ide_submit
   };
 
+/* Request processing.
+
+   Each disk has a queue of block_requests.  A channel works on
+   one request at a time, alternating between its two disks'
+   queues.  A request is split into commands of at most
+   MAX_SECTORS_PER_COMMAND sectors.  A DMA command interrupts
+   once, at its end.  A PIO command interrupts once per sector:
+   for reads, when the sector's data is ready; for writes, when
+   the disk has taken a sector, after which we hand it the next.
+
+   All of this runs with interrupts off, mostly in the interrupt
+   handler, so it busy-waits instead of sleeping. */
+
+/* If channel C is idle, takes the next queued request, if any,
+   and starts it. */
+static void
+start_request (struct channel *c)
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (c->active == NULL);
+
+  for (i = 0; i < 2; i++)
+    {
+      struct ata_disk *d = &c->devices[(c->next_dev + i) % 2];
+      if (!list_empty (&d->queue))
+        {
+          c->active = list_entry (list_pop_front (&d->queue),
+                                  struct block_request, elem);
+          c->active_disk = d;
+          c->done = 0;
+          c->next_dev = (d->dev_no + 1) % 2;
+          start_command (c);
+          return;
+        }
+    }
+}
+
+/* Issues the command for the next part of channel C's active
+   request. */
+static void
+start_command (struct channel *c)
+{
+  struct ata_disk *d = c->active_disk;
+  struct block_request *r = c->active;
+  block_sector_t sec_no = r->dev_sector + c->done;
+  size_t n = r->dev_cnt - c->done;
+
+  if (n > MAX_SECTORS_PER_COMMAND)
+    n = MAX_SECTORS_PER_COMMAND;
+  c->cmd_end = c->done + n;
+  c->cmd_dma = d->dma && build_prd_table (c, r, c->done, n);
+
+  if (c->cmd_dma)
+    dma_start (d, sec_no, n, !r->write);
+  else if (!r->write)
+    {
+      select_sector (d, sec_no, n);
+      issue_command (c, CMD_READ_SECTOR_RETRY);
+    }
+  else
+    {
+      select_sector (d, sec_no, n);
+      issue_command (c, CMD_WRITE_SECTOR_RETRY);
+      if (!poll_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+      output_sector (c, block_request_buffer (r, c->done));
+    }
+}
+
+/* Advances channel C's active request after an interrupt.
+   Completes the request and starts the next one when it is
+   done. */
+static void
+continue_request (struct channel *c)
+{
+  struct ata_disk *d = c->active_disk;
+  struct block_request *r = c->active;
+
+  if (c->cmd_dma)
+    {
+      if (!dma_finish (c))
+        {
+          /* Redo the command without DMA. */
+          printf ("%s: DMA %s failed, falling back to PIO\n",
+                  d->name, r->write ? "write" : "read");
+          d->dma = false;
+          start_command (c);
+          return;
+        }
+      c->done = c->cmd_end;
+    }
+  else
+    {
+      block_sector_t sec_no = r->dev_sector + c->done;
+
+      inb (reg_status (c));             /* Acknowledge interrupt. */
+      if (!r->write)
+        {
+          if (!poll_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
+          input_sector (c, block_request_buffer (r, c->done));
+        }
+      else if (inb (reg_alt_status (c)) & STA_ERR)
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+      c->done++;
+
+      if (c->done < c->cmd_end)
+        {
+          /* More sectors to go in this command. */
+          if (r->write)
+            {
+              if (!poll_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + 1);
+              output_sector (c, block_request_buffer (r, c->done));
+            }
+          return;
+        }
+    }
+
+  if (c->done < r->dev_cnt)
+    start_command (c);
+  else
+    {
+      /* Completion may submit a new request, which starts it. */
+      c->active = NULL;
+      block_complete (r);
+      if (c->active == NULL)
+        start_request (c);
+    }
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number of sectors CNT, at most
+   MAX_SECTORS_PER_COMMAND, to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (sec_no + cnt <= (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_COMMAND);
 
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS_PER_COMMAND ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -404,14 +660,137 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
+issue_command (struct channel *c, uint8_t command)
+{
+  c->expecting_interrupt = true;
+  outb (reg_command (c), command);
+}
+
+/* Writes COMMAND to channel C, whose completion interrupt the
+   caller will wait for on the channel's semaphore. */
+static void
 issue_pio_command (struct channel *c, uint8_t command)
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
   ASSERT (intr_get_level () == INTR_ON);
 
-  c->expecting_interrupt = true;
-  outb (reg_command (c), command);
+  issue_command (c, command);
+}
+
+/* Returns true if the SIZE bytes at BUFFER can be transferred
+   by DMA.  The bus master needs physical addresses, so BUFFER
+   must be in kernel memory, whose pages are physically
+   contiguous; user buffers and anything odd-aligned use PIO. */
+static bool
+dma_buffer_ok (const void *buffer, size_t size)
+{
+  const uint8_t *end = (const uint8_t *) buffer + size;
+
+  return (is_kernel_vaddr (buffer)
+          && end <= (const uint8_t *) ptov (init_ram_pages * PGSIZE)
+          && ((uintptr_t) buffer & 1) == 0);
+}
+
+/* Fills in channel C's PRD table to describe CNT sectors of
+   request R, starting from sector FIRST.  Merged requests have
+   separate buffers, so this gathers them, coalescing buffers
+   that happen to be physically adjacent and splitting at 64 kB
+   boundaries as the bus master requires.  Returns false,
+   leaving the transfer to PIO, if some buffer cannot be reached
+   by DMA or the table overflows. */
+static bool
+build_prd_table (struct channel *c, const struct block_request *r,
+                 size_t first, size_t cnt)
+{
+  struct prd *prd = c->prd_table;
+  struct prd *prd_end = c->prd_table + PGSIZE / sizeof *prd;
+  uintptr_t next_addr = 0;
+
+  while (first >= r->cnt)
+    {
+      first -= r->cnt;
+      r = r->merged;
+    }
+
+  while (cnt > 0)
+    {
+      size_t n = r->cnt - first < cnt ? r->cnt - first : cnt;
+      const uint8_t *buffer = ((const uint8_t *) r->buffer
+                               + first * BLOCK_SECTOR_SIZE);
+      size_t size = n * BLOCK_SECTOR_SIZE;
+      uintptr_t addr;
+
+      if (!dma_buffer_ok (buffer, size))
+        return false;
+      addr = vtop (buffer);
+      while (size > 0)
+        {
+          size_t chunk = 0x10000 - (addr & 0xffff);
+          if (chunk > size)
+            chunk = size;
+
+          if (prd > c->prd_table && addr == next_addr && (addr & 0xffff) != 0)
+            prd[-1].size += chunk;
+          else if (prd < prd_end)
+            {
+              prd->addr = addr;
+              prd->size = chunk & 0xffff;
+              prd->flags = 0;
+              prd++;
+            }
+          else
+            return false;
+
+          addr += chunk;
+          next_addr = addr;
+          size -= chunk;
+        }
+
+      cnt -= n;
+      first = 0;
+      r = r->merged;
+    }
+  prd[-1].flags = PRD_EOT;
+  return true;
+}
+
+/* Starts a bus-master DMA transfer of CNT sectors, at most
+   MAX_SECTORS_PER_COMMAND, between disk D starting at SEC_NO and
+   the memory described by the channel's PRD table: from disk to
+   memory if READ, otherwise the reverse.  The channel interrupts
+   once the transfer is done. */
+static void
+dma_start (struct ata_disk *d, block_sector_t sec_no, size_t cnt, bool read)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = read ? BM_CMD_READ : 0;
+
+  /* Point the bus master at the PRD table and clear stale status. */
+  outl (reg_bm_prdt (c), vtop (c->prd_table));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), BM_STA_INTR | BM_STA_ERR);
+
+  /* Issue the command, then start the engine. */
+  select_sector (d, sec_no, cnt);
+  issue_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+}
+
+/* Stops channel C's bus master after its completion interrupt
+   and acknowledges the interrupt.  Returns true if the transfer
+   succeeded, false if the controller or disk reported an
+   error. */
+static bool
+dma_finish (struct channel *c)
+{
+  uint8_t bm_status, status;
+
+  outb (reg_bm_command (c), inb (reg_bm_command (c)) & ~BM_CMD_START);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), BM_STA_INTR | BM_STA_ERR);
+  status = inb (reg_status (c));
+  return !(bm_status & BM_STA_ERR) && !(status & STA_ERR);
 }
 
 /* Reads a sector from channel C's data register in PIO mode into
@@ -446,7 +825,7 @@ wait_until_idle (const struct ata_disk *d)
     {
       if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
         return;
-      timer_usleep (10);
+      timer_udelay (10);
     }
 
   printf ("%s: idle timeout\n", d->name);
@@ -479,6 +858,24 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
+/* Like wait_while_busy(), but busy-waits, and for at most about
+   a second, so that it may be used with interrupts off. */
+static bool
+poll_while_busy (const struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  int i;
+
+  for (i = 0; i < 100000; i++)
+    {
+      uint8_t status = inb (reg_alt_status (c));
+      if (!(status & STA_BSY))
+        return (status & STA_DRQ) != 0;
+      timer_udelay (10);
+    }
+  return false;
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -489,7 +886,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -511,7 +908,9 @@ interrupt_handler (struct intr_frame *f)
   for (c = channels; c < channels + CHANNEL_CNT; c++)
     if (f->vec_no == c->irq)
       {
-        if (c->expecting_interrupt)
+        if (c->active != NULL)
+          continue_request (c);
+        else if (c->expecting_interrupt)
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
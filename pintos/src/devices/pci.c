@@ -0,0 +1,166 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* The code in this file accesses PCI configuration space using
+   configuration mechanism #1, which every PC since the early
+   1990s supports.  We only need enough of it to locate a device
+   and learn its resources; there is no general bus driver. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8        /* Address (w/o). */
+#define PCI_CONFIG_DATA 0xcfc           /* Data (r/w). */
+
+/* Base address register bits. */
+#define PCI_BAR_IO 0x1                  /* BAR is in I/O space. */
+
+static bool pci_find (bool (*match) (const struct pci_device *, void *aux),
+                      void *aux, int index, struct pci_device *);
+
+/* Selects register REG of PCI function P for the next access to
+   PCI_CONFIG_DATA. */
+static void
+select_config (const struct pci_device *p, uint8_t reg)
+{
+  ASSERT (p->dev < 32 && p->func < 8);
+  ASSERT (reg % 4 == 0);
+
+  outl (PCI_CONFIG_ADDRESS, (1u << 31) | (p->bus << 16) | (p->dev << 11)
+                            | (p->func << 8) | reg);
+}
+
+/* Returns the 32-bit configuration register at byte offset REG,
+   which must be a multiple of 4, in PCI function P. */
+uint32_t
+pci_read_config (const struct pci_device *p, uint8_t reg)
+{
+  select_config (p, reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit configuration register at byte
+   offset REG, which must be a multiple of 4, in PCI function P. */
+void
+pci_write_config (const struct pci_device *p, uint8_t reg, uint32_t value)
+{
+  select_config (p, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Class match function for pci_find().  AUX points to a 16-bit
+   value holding the class in its high byte and the subclass in
+   its low byte. */
+static bool
+match_class (const struct pci_device *p, void *aux)
+{
+  const uint16_t *class = aux;
+  return (pci_read_config (p, PCI_REG_CLASS) >> 16) == *class;
+}
+
+/* Searches for the first PCI function with the given CLASS and
+   SUBCLASS.  If one is found, stores its location in *P and
+   returns true; otherwise, returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_device *p)
+{
+  uint16_t key = (class << 8) | subclass;
+  return pci_find (match_class, &key, 0, p);
+}
+
+/* Vendor/device ID match function for pci_find().  AUX points
+   to a 32-bit value laid out like PCI_REG_ID. */
+static bool
+match_id (const struct pci_device *p, void *aux)
+{
+  const uint32_t *id = aux;
+  return pci_read_config (p, PCI_REG_ID) == *id;
+}
+
+/* Searches for the PCI function with the given VENDOR and
+   DEVICE IDs that comes INDEX'th (counting from 0) in bus order.
+   If one is found, stores its location in *P and returns true;
+   otherwise, returns false. */
+bool
+pci_find_id (uint16_t vendor, uint16_t device, int index,
+             struct pci_device *p)
+{
+  uint32_t key = ((uint32_t) device << 16) | vendor;
+  return pci_find (match_id, &key, index, p);
+}
+
+/* Returns the I/O port base address in base address register
+   BAR (0...5) of PCI function P, or 0 if that BAR is unused or
+   maps memory rather than I/O space. */
+uint16_t
+pci_io_base (const struct pci_device *p, int bar)
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+
+  value = pci_read_config (p, PCI_REG_BAR0 + bar * 4);
+  if (!(value & PCI_BAR_IO))
+    return 0;
+  return value & 0xfffc;
+}
+
+/* Returns the legacy interrupt line that the firmware routed
+   PCI function P to, or 0xff if none. */
+uint8_t
+pci_irq (const struct pci_device *p)
+{
+  return pci_read_config (p, PCI_REG_IRQ) & 0xff;
+}
+
+/* Allows PCI function P to decode I/O accesses and to master
+   the bus, so that it can perform DMA. */
+void
+pci_enable_master (const struct pci_device *p)
+{
+  uint32_t command = pci_read_config (p, PCI_REG_COMMAND);
+
+  /* Keep the status half zero: its bits are write-1-to-clear. */
+  command = (command & 0xffff) | PCI_CMD_IO | PCI_CMD_MASTER;
+  pci_write_config (p, PCI_REG_COMMAND, command);
+}
+
+/* Scans every PCI bus for functions for which MATCH, given AUX,
+   returns true.  Skips the first INDEX of them, stores the next
+   one in *P and returns true, or returns false if there are not
+   that many. */
+static bool
+pci_find (bool (*match) (const struct pci_device *, void *aux), void *aux,
+          int index, struct pci_device *p)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          struct pci_device cur;
+
+          cur.bus = bus;
+          cur.dev = dev;
+          cur.func = func;
+          if ((pci_read_config (&cur, PCI_REG_ID) & 0xffff) == 0xffff)
+            {
+              /* No such function.  If function 0 is absent, so is
+                 the whole device. */
+              if (func == 0)
+                break;
+              continue;
+            }
+          if (match (&cur, aux) && index-- == 0)
+            {
+              *p = cur;
+              return true;
+            }
+
+          /* Only multi-function devices have functions 1...7. */
+          if (func == 0
+              && !(pci_read_config (&cur, PCI_REG_HEADER) & 0x800000))
+            break;
+        }
+  return false;
+}
@@ -0,0 +1,47 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Location of a PCI function in configuration space. */
+struct pci_device
+  {
+    uint8_t bus;                /* Bus number, 0...255. */
+    uint8_t dev;                /* Device number, 0...31. */
+    uint8_t func;               /* Function number, 0...7. */
+  };
+
+/* Configuration space registers (byte offsets). */
+#define PCI_REG_ID 0x00         /* Device ID (31:16), vendor ID (15:0). */
+#define PCI_REG_COMMAND 0x04    /* Status (31:16), command (15:0). */
+#define PCI_REG_CLASS 0x08      /* Class (31:24), subclass (23:16). */
+#define PCI_REG_HEADER 0x0c     /* Header type in bits 23:16. */
+#define PCI_REG_BAR0 0x10       /* First of six base address registers. */
+#define PCI_REG_IRQ 0x3c        /* Interrupt line in bits 7:0. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_CMD_MEMORY 0x0002   /* Respond to memory space accesses. */
+#define PCI_CMD_MASTER 0x0004   /* May act as a bus master (DMA). */
+
+/* Device classes that we know about. */
+#define PCI_CLASS_STORAGE 0x01  /* Mass storage controller. */
+#define PCI_SUBCLASS_IDE 0x01   /* IDE controller. */
+
+/* Vendor and device IDs that we know about. */
+#define PCI_VENDOR_VIRTIO 0x1af4        /* Red Hat/Qumranet virtio. */
+#define PCI_DEVICE_VIRTIO_BLK 0x1001    /* Transitional virtio-blk. */
+
+uint32_t pci_read_config (const struct pci_device *, uint8_t reg);
+void pci_write_config (const struct pci_device *, uint8_t reg, uint32_t);
+
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_device *);
+bool pci_find_id (uint16_t vendor, uint16_t device, int index,
+                  struct pci_device *);
+
+uint16_t pci_io_base (const struct pci_device *, int bar);
+uint8_t pci_irq (const struct pci_device *);
+void pci_enable_master (const struct pci_device *);
+
+#endif /* devices/pci.h */
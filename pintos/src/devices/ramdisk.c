@@ -0,0 +1,154 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in RAM.  Its sectors live in pages from
+   the page allocator, so a transfer is just a memcpy().  That
+   makes it useful for measuring the file system's own CPU cost
+   apart from any disk's, and for scratch data that need not
+   survive a reboot.
+
+   The ramdisk is registered as a raw device, "ram0", so it does
+   not take over any role by default; pass e.g. -filesys=ram0 to
+   use it.  It starts out zeroed. */
+
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Size requested on the command line, in sectors. */
+static size_t ramdisk_sectors;
+
+/* The ramdisk. */
+struct ramdisk
+  {
+    size_t page_cnt;            /* Number of pages. */
+    uint8_t **pages;            /* Array of PAGE_CNT pages. */
+  };
+
+static struct ramdisk ramdisk;
+
+static struct block_operations ramdisk_operations;
+
+/* Sets the size of the ramdisk to create to SECTOR_CNT sectors.
+   0, the default, means no ramdisk. */
+void
+ramdisk_set_size (size_t sector_cnt)
+{
+  ramdisk_sectors = sector_cnt;
+}
+
+/* Allocates the ramdisk, if one was asked for, and registers it
+   with the block layer. */
+void
+ramdisk_init (void)
+{
+  struct ramdisk *rd = &ramdisk;
+  size_t i;
+
+  if (ramdisk_sectors == 0)
+    return;
+
+  rd->page_cnt = DIV_ROUND_UP (ramdisk_sectors, SECTORS_PER_PAGE);
+  rd->pages = malloc (rd->page_cnt * sizeof *rd->pages);
+  if (rd->pages == NULL)
+    PANIC ("ramdisk: out of memory for page table");
+
+  /* Prefer the user pool, leaving the kernel pool for the
+     kernel's own use. */
+  for (i = 0; i < rd->page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_USER | PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("ramdisk: out of memory for %zu sectors", ramdisk_sectors);
+    }
+
+  block_register ("ram0", BLOCK_RAW, "RAM disk", ramdisk_sectors, 1,
+                  &ramdisk_operations, rd);
+}
+
+/* Returns the address of sector SEC_NO in ramdisk RD. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sec_no)
+{
+  return (rd->pages[sec_no / SECTORS_PER_PAGE]
+          + sec_no % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads CNT sectors starting at SEC_NO from ramdisk RD into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Copies a page's worth of sectors at a time. */
+static void
+ramdisk_read_multiple (void *rd_, block_sector_t sec_no, size_t cnt,
+                       void *buffer_)
+{
+  struct ramdisk *rd = rd_;
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t n = SECTORS_PER_PAGE - sec_no % SECTORS_PER_PAGE;
+      if (n > cnt)
+        n = cnt;
+
+      memcpy (buffer, sector_addr (rd, sec_no), n * BLOCK_SECTOR_SIZE);
+      sec_no += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+}
+
+/* Writes CNT sectors starting at SEC_NO to ramdisk RD from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write_multiple (void *rd_, block_sector_t sec_no, size_t cnt,
+                        const void *buffer_)
+{
+  struct ramdisk *rd = rd_;
+  const uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t n = SECTORS_PER_PAGE - sec_no % SECTORS_PER_PAGE;
+      if (n > cnt)
+        n = cnt;
+
+      memcpy (sector_addr (rd, sec_no), buffer, n * BLOCK_SECTOR_SIZE);
+      sec_no += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+}
+
+/* Reads sector SEC_NO from ramdisk RD into BUFFER, which must
+   have room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_read (void *rd, block_sector_t sec_no, void *buffer)
+{
+  ramdisk_read_multiple (rd, sec_no, 1, buffer);
+}
+
+/* Writes sector SEC_NO to ramdisk RD from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write (void *rd, block_sector_t sec_no, const void *buffer)
+{
+  ramdisk_write_multiple (rd, sec_no, 1, buffer);
+}
+
+/* There is no submit operation: a transfer finishes as soon as
+   it starts, so the block layer runs it synchronously, without
+   queuing or scheduling. */
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL
+  };
@@ -0,0 +1,9 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include <stddef.h>
+
+void ramdisk_set_size (size_t sector_cnt);
+void ramdisk_init (void);
+
+#endif /* devices/ramdisk.h */
@@ -1,6 +1,7 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
@@ -24,6 +25,19 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* A thread blocked in timer_sleep() or timer_sema_down(). */
+struct sleeper
+  {
+    struct list_elem elem;      /* Element in sleepers. */
+    int64_t wake;               /* Tick at which to wake up. */
+    struct semaphore *sema;     /* Upped when it is time. */
+    bool queued;                /* True while in sleepers. */
+  };
+
+/* Sleeping threads in order of wake tick.  Protected by
+   disabling interrupts, since the timer interrupt wakes them. */
+static struct list sleepers;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
@@ -36,6 +50,7 @@ void
 timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
+  list_init (&sleepers);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -84,16 +99,55 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns true if sleeper A wakes before sleeper B. */
+static bool
+wakes_before (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct sleeper *a = list_entry (a_, struct sleeper, elem);
+  const struct sleeper *b = list_entry (b_, struct sleeper, elem);
+  return a->wake < b->wake;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.  The thread is blocked until the timer interrupt
+   wakes it, rather than yielding again and again. */
 void
 timer_sleep (int64_t ticks)
 {
-  int64_t start = timer_ticks ();
+  struct semaphore sema;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks)
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  sema_init (&sema, 0);
+  timer_sema_down (&sema, ticks);
+}
+
+/* Downs SEMA, waiting for someone else to up it for at most about
+   TICKS timer ticks, after which the timer interrupt ups it.  The
+   caller cannot tell which happened, and a timeout that races
+   with another up may leave SEMA upped once more than expected,
+   so it should check for itself what it was waiting for.
+   Interrupts must be turned on. */
+void
+timer_sema_down (struct semaphore *sema, int64_t ticks)
+{
+  struct sleeper s;
+  enum intr_level old_level;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  old_level = intr_disable ();
+  s.wake = ticks + timer_ticks ();
+  s.sema = sema;
+  s.queued = true;
+  list_insert_ordered (&sleepers, &s.elem, wakes_before, NULL);
+  sema_down (sema);
+  if (s.queued)
+    list_remove (&s.elem);
+  intr_set_level (old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -171,6 +225,16 @@ static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
+  while (!list_empty (&sleepers))
+    {
+      struct sleeper *s = list_entry (list_front (&sleepers),
+                                      struct sleeper, elem);
+      if (s->wake > ticks)
+        break;
+      list_pop_front (&sleepers);
+      s->queued = false;
+      sema_up (s->sema);
+    }
   thread_tick ();
 }
 
@@ -223,7 +287,7 @@ real_time_sleep (int64_t num, int32_t denom)
   if (ticks > 0)
     {
       /* We're waiting for at least one full timer tick.  Use
-         timer_sleep() because it will yield the CPU to other
+         timer_sleep() because it will give the CPU to other
          processes. */
       timer_sleep (ticks);
     }
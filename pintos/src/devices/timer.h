@@ -7,6 +7,8 @@
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+struct semaphore;
+
 void timer_init (void);
 void timer_calibrate (void);
 
@@ -18,6 +20,7 @@ void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
+void timer_sema_down (struct semaphore *, int64_t ticks);
 
 /* Busy waits. */
 void timer_mdelay (int64_t milliseconds);
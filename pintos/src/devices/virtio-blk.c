@@ -0,0 +1,586 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file drives virtio block devices through the
+   "legacy" PCI interface that QEMU's transitional virtio-blk
+   device offers.  See [virtio-0.9.5].
+
+   Each device has a single virtqueue shared with the host.  A
+   request is a chain of descriptors: a header naming the
+   operation and sector, one descriptor per physically contiguous
+   piece of the data, and a status byte for the host to fill in.
+   Many requests may be outstanding at once; the host reports
+   completions in the used ring and interrupts. */
+
+/* Legacy virtio PCI registers, as offsets from the I/O BAR. */
+#define REG_HOST_FEATURES 0x00  /* Features the device offers (32 bits). */
+#define REG_GUEST_FEATURES 0x04 /* Features the driver accepts (32 bits). */
+#define REG_QUEUE_PFN 0x08      /* Page number of the virtqueue (32 bits). */
+#define REG_QUEUE_NUM 0x0c      /* Size of the virtqueue (16 bits). */
+#define REG_QUEUE_SEL 0x0e      /* Virtqueue selector (16 bits). */
+#define REG_QUEUE_NOTIFY 0x10   /* Virtqueue notifier (16 bits). */
+#define REG_STATUS 0x12         /* Device status (8 bits). */
+#define REG_ISR 0x13            /* Interrupt status, cleared on read. */
+#define REG_CONFIG 0x14         /* Start of virtio-blk configuration. */
+
+/* virtio-blk configuration fields, as offsets from REG_CONFIG. */
+#define CONFIG_CAPACITY 0x00    /* Size in 512-byte sectors (64 bits). */
+#define CONFIG_SEG_MAX 0x0c     /* Most data segments per request. */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* We noticed the device. */
+#define STATUS_DRIVER 0x02      /* We know how to drive it. */
+#define STATUS_DRIVER_OK 0x04   /* We are ready to use it. */
+
+/* Feature bits. */
+#define FEATURE_SEG_MAX (1u << 2)       /* CONFIG_SEG_MAX is valid. */
+
+/* Interrupt status bits. */
+#define ISR_QUEUE 0x01          /* The used ring has new entries. */
+
+/* Virtqueue descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_* flags. */
+    uint16_t next;              /* Next descriptor if VRING_DESC_F_NEXT. */
+  };
+
+#define VRING_DESC_F_NEXT 1     /* Chain continues in NEXT. */
+#define VRING_DESC_F_WRITE 2    /* Device writes, rather than reads, it. */
+
+/* Ring of descriptor chains the driver offers the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the driver puts the next entry. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+/* Ring of descriptor chains the device has finished with. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of the descriptor chain. */
+    uint32_t len;               /* Bytes written into it. */
+  };
+
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the device puts the next entry. */
+    struct vring_used_elem ring[];
+  };
+
+/* Legacy virtqueues align the used ring to a page. */
+#define VRING_ALIGN PGSIZE
+
+/* virtio-blk request header. */
+struct virtio_blk_header
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t ioprio;            /* Priority, unused. */
+    uint64_t sector;            /* First sector. */
+  };
+
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+
+/* Per-descriptor-chain memory the device reads and writes,
+   indexed by the chain's head descriptor. */
+struct slot
+  {
+    struct virtio_blk_header header;    /* Request header. */
+    uint8_t status;                     /* Status written by device. */
+    struct operation *op;               /* Operation this is part of. */
+  };
+
+/* A block_request being carried out.  If it needs more data
+   descriptors than the device takes at once, it is issued as
+   several virtio requests, or "parts". */
+struct operation
+  {
+    struct block_request *r;    /* Request, or null if free. */
+    size_t issued;              /* Sectors issued so far. */
+    unsigned parts;             /* Parts issued but not completed. */
+  };
+
+/* A virtio block device. */
+struct virtio_blk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base of legacy registers. */
+    uint8_t irq;                /* Interrupt in use. */
+
+    /* Virtqueue and its bookkeeping.  All of these members are
+       protected by disabling interrupts. */
+    uint16_t queue_size;        /* Number of descriptors. */
+    size_t seg_max;             /* Most data descriptors per part. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    struct vring_used *used;    /* Used ring. */
+    uint16_t free_head;         /* First free descriptor. */
+    uint16_t free_cnt;          /* Number of free descriptors. */
+    uint16_t last_used;         /* Next used ring entry to look at. */
+    struct slot *slots;         /* QUEUE_SIZE slots. */
+    struct operation *ops;      /* QUEUE_SIZE operations. */
+
+    struct list queue;          /* block_requests not yet fully issued. */
+    struct operation *front_op; /* Operation for QUEUE's front, if
+                                   partially issued. */
+  };
+
+/* Most virtio block devices we support. */
+#define DEVICE_MAX 4
+static struct virtio_blk devices[DEVICE_MAX];
+static size_t device_cnt;
+
+static struct block_operations virtio_blk_operations;
+
+static struct block *init_device (struct virtio_blk *,
+                                  const struct pci_device *);
+static void kick (struct virtio_blk *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds and initializes the virtio block devices on the PCI bus,
+   registering each with the block layer. */
+void
+virtio_blk_init (void)
+{
+  struct pci_device pci;
+  int i;
+
+  for (i = 0; device_cnt < DEVICE_MAX
+              && pci_find_id (PCI_VENDOR_VIRTIO, PCI_DEVICE_VIRTIO_BLK, i,
+                              &pci); i++)
+    {
+      struct virtio_blk *d = &devices[device_cnt];
+      struct block *block;
+
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) device_cnt);
+      block = init_device (d, &pci);
+      if (block != NULL)
+        {
+          /* The interrupt handler only looks at counted devices, so
+             count D before scanning it for partitions reads from it. */
+          device_cnt++;
+          partition_scan (block);
+        }
+    }
+}
+
+/* Returns the number of bytes of page-aligned memory needed for
+   a legacy virtqueue with QUEUE_SIZE descriptors. */
+static size_t
+vring_size (uint16_t queue_size)
+{
+  size_t avail_end = (queue_size * sizeof (struct vring_desc)
+                      + sizeof (struct vring_avail)
+                      + (queue_size + 1) * sizeof (uint16_t));
+  size_t used_size = (sizeof (struct vring_used)
+                      + queue_size * sizeof (struct vring_used_elem)
+                      + sizeof (uint16_t));
+
+  return ROUND_UP (avail_end, VRING_ALIGN) + ROUND_UP (used_size, VRING_ALIGN);
+}
+
+/* Brings up virtio block device D found at PCI function P and
+   registers it.  Returns the registered block device if
+   successful, a null pointer if the device could not be set up. */
+static struct block *
+init_device (struct virtio_blk *d, const struct pci_device *p)
+{
+  uint32_t features;
+  uint64_t capacity;
+  uint8_t *ring;
+  size_t slot_pages;
+  char extra_info[64];
+  size_t i;
+
+  d->io_base = pci_io_base (p, 0);
+  d->irq = pci_irq (p);
+  if (d->io_base == 0 || d->irq >= 16)
+    {
+      printf ("%s: no usable I/O ports or interrupt\n", d->name);
+      return NULL;
+    }
+  pci_enable_master (p);
+
+  /* Reset the device, then tell it we're here. */
+  outb (d->io_base + REG_STATUS, 0);
+  outb (d->io_base + REG_STATUS, STATUS_ACKNOWLEDGE);
+  outb (d->io_base + REG_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+
+  /* The only feature we care about is the segment limit. */
+  features = inl (d->io_base + REG_HOST_FEATURES) & FEATURE_SEG_MAX;
+  outl (d->io_base + REG_GUEST_FEATURES, features);
+
+  /* Set up virtqueue 0.  Its memory must be physically contiguous,
+     which pages from the kernel pool are. */
+  outw (d->io_base + REG_QUEUE_SEL, 0);
+  d->queue_size = inw (d->io_base + REG_QUEUE_NUM);
+  if (d->queue_size < 3)
+    {
+      printf ("%s: virtqueue too small\n", d->name);
+      return NULL;
+    }
+  ring = palloc_get_multiple (PAL_ZERO, vring_size (d->queue_size) / PGSIZE);
+  slot_pages = DIV_ROUND_UP (d->queue_size * sizeof *d->slots, PGSIZE);
+  d->slots = palloc_get_multiple (PAL_ZERO, slot_pages);
+  d->ops = calloc (d->queue_size, sizeof *d->ops);
+  if (ring == NULL || d->slots == NULL || d->ops == NULL)
+    PANIC ("%s: out of memory for virtqueue", d->name);
+
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + d->queue_size * sizeof *d->desc);
+  d->used = (struct vring_used *)
+    (ring + ROUND_UP ((uint8_t *) &d->avail->ring[d->queue_size + 1] - ring,
+                      VRING_ALIGN));
+  for (i = 0; i < d->queue_size; i++)
+    d->desc[i].next = i + 1;
+  d->free_head = 0;
+  d->free_cnt = d->queue_size;
+  d->last_used = 0;
+  list_init (&d->queue);
+  d->front_op = NULL;
+  outl (d->io_base + REG_QUEUE_PFN, vtop (ring) / PGSIZE);
+
+  /* Each part needs a header and a status descriptor besides its
+     data descriptors. */
+  d->seg_max = d->queue_size - 2;
+  if (features & FEATURE_SEG_MAX)
+    {
+      uint32_t seg_max = inl (d->io_base + REG_CONFIG + CONFIG_SEG_MAX);
+      if (seg_max > 0 && seg_max < d->seg_max)
+        d->seg_max = seg_max;
+    }
+
+  capacity = (inl (d->io_base + REG_CONFIG + CONFIG_CAPACITY)
+              | (uint64_t) inl (d->io_base + REG_CONFIG + CONFIG_CAPACITY + 4)
+                << 32);
+  if (capacity > UINT32_MAX)
+    capacity = UINT32_MAX;
+
+  /* Devices may share an interrupt line, so register one handler
+     per line and have it check every device. */
+  for (i = 0; i < device_cnt; i++)
+    if (devices[i].irq == d->irq)
+      break;
+  if (i == device_cnt)
+    intr_register_ext (d->irq + 0x20, interrupt_handler, "virtio-blk");
+
+  outb (d->io_base + REG_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  snprintf (extra_info, sizeof extra_info, "virtio-blk, %u-entry queue",
+            (unsigned) d->queue_size);
+  /* Every request takes at least a header, a data and a status
+     descriptor, so the virtqueue holds at most a third as many
+     requests as descriptors.  Let the scheduler keep it that full. */
+  return block_register (d->name, BLOCK_RAW, extra_info, capacity,
+                         d->queue_size / 3, &virtio_blk_operations, d);
+}
+
+/* Queues request R, whose DEV_SECTOR is relative to device D,
+   and issues as much of it as the virtqueue has room for.  The
+   interrupt handler calls block_complete() when it is done. */
+static void
+virtio_blk_submit (void *d_, struct block_request *r)
+{
+  struct virtio_blk *d = d_;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  list_push_back (&d->queue, &r->elem);
+  kick (d);
+  intr_set_level (old_level);
+}
+
+/* Reads CNT sectors starting at SEC_NO from device D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes, by queuing a request and waiting for it. */
+static void
+virtio_blk_read_multiple (void *d, block_sector_t sec_no, size_t cnt,
+                          void *buffer)
+{
+  struct block_request r;
+
+  block_request_init (&r, false, sec_no, cnt, buffer, NULL, NULL);
+  virtio_blk_submit (d, &r);
+  block_wait (&r);
+}
+
+/* Writes CNT sectors starting at SEC_NO to device D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, by queuing a
+   request and waiting for it. */
+static void
+virtio_blk_write_multiple (void *d, block_sector_t sec_no, size_t cnt,
+                           const void *buffer)
+{
+  struct block_request r;
+
+  block_request_init (&r, true, sec_no, cnt, (void *) buffer, NULL, NULL);
+  virtio_blk_submit (d, &r);
+  block_wait (&r);
+}
+
+/* Reads sector SEC_NO from device D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_blk_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  virtio_blk_read_multiple (d, sec_no, 1, buffer);
+}
+
+/* Writes sector SEC_NO to device D from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_blk_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  virtio_blk_write_multiple (d, sec_no, 1, buffer);
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    virtio_blk_read,
+    virtio_blk_write,
+    virtio_blk_read_multiple,
+    virtio_blk_write_multiple,
+    virtio_blk_submit
+  };
+
+/* Virtqueue management. */
+
+/* Takes a descriptor off device D's free list and returns its
+   index.  There must be one. */
+static uint16_t
+alloc_desc (struct virtio_blk *d)
+{
+  uint16_t i = d->free_head;
+
+  ASSERT (d->free_cnt > 0);
+  d->free_head = d->desc[i].next;
+  d->free_cnt--;
+  return i;
+}
+
+/* Returns the descriptor chain starting at HEAD in device D to
+   the free list. */
+static void
+free_chain (struct virtio_blk *d, uint16_t head)
+{
+  uint16_t i = head;
+
+  for (;;)
+    {
+      uint16_t flags = d->desc[i].flags;
+      uint16_t next = d->desc[i].next;
+
+      d->desc[i].next = d->free_head;
+      d->free_head = i;
+      d->free_cnt++;
+      if (!(flags & VRING_DESC_F_NEXT))
+        break;
+      i = next;
+    }
+}
+
+/* Returns a free operation in device D, or a null pointer if
+   there is none. */
+static struct operation *
+alloc_op (struct virtio_blk *d)
+{
+  size_t i;
+
+  for (i = 0; i < d->queue_size; i++)
+    if (d->ops[i].r == NULL)
+      return &d->ops[i];
+  return NULL;
+}
+
+/* Offers device D the next part of operation OP, using as many
+   data descriptors as D's free list and segment limit allow.
+   Data buffers that happen to be physically adjacent share a
+   descriptor.  The caller must ensure at least 3 descriptors are
+   free. */
+static void
+issue_part (struct virtio_blk *d, struct operation *op)
+{
+  struct block_request *r = op->r;
+  struct block_request *m = r;
+  size_t skip = op->issued;
+  size_t seg_max = d->free_cnt - 2;
+  size_t segs = 0, sectors = 0;
+  struct vring_desc *last = NULL;
+  uint16_t head, prev, status;
+  struct slot *slot;
+
+  ASSERT (d->free_cnt >= 3);
+  if (seg_max > d->seg_max)
+    seg_max = d->seg_max;
+
+  /* Header. */
+  head = alloc_desc (d);
+  slot = &d->slots[head];
+  slot->header.type = r->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  slot->header.ioprio = 0;
+  slot->header.sector = r->dev_sector + op->issued;
+  slot->status = 0xff;
+  slot->op = op;
+  d->desc[head].addr = vtop (&slot->header);
+  d->desc[head].len = sizeof slot->header;
+  d->desc[head].flags = VRING_DESC_F_NEXT;
+  prev = head;
+
+  /* Data, walking the chain of merged requests from the first
+     sector not yet issued. */
+  while (skip >= m->cnt)
+    {
+      skip -= m->cnt;
+      m = m->merged;
+    }
+  for (; m != NULL; m = m->merged, skip = 0)
+    {
+      uint8_t *buffer = (uint8_t *) m->buffer + skip * BLOCK_SECTOR_SIZE;
+      uint32_t len = (m->cnt - skip) * BLOCK_SECTOR_SIZE;
+      uintptr_t addr;
+
+      /* The block layer bounces user buffers, so this holds. */
+      ASSERT (is_kernel_vaddr (buffer));
+      addr = vtop (buffer);
+
+      if (last != NULL && last->addr + last->len == addr)
+        last->len += len;
+      else if (segs < seg_max)
+        {
+          uint16_t i = alloc_desc (d);
+
+          d->desc[prev].next = i;
+          last = &d->desc[i];
+          last->addr = addr;
+          last->len = len;
+          last->flags = VRING_DESC_F_NEXT | (r->write ? 0 : VRING_DESC_F_WRITE);
+          prev = i;
+          segs++;
+        }
+      else
+        break;
+      sectors += m->cnt - skip;
+    }
+
+  /* Status. */
+  status = alloc_desc (d);
+  d->desc[prev].next = status;
+  d->desc[status].addr = vtop (&slot->status);
+  d->desc[status].len = sizeof slot->status;
+  d->desc[status].flags = VRING_DESC_F_WRITE;
+
+  op->issued += sectors;
+  op->parts++;
+
+  /* Publish the chain, then the new index. */
+  d->avail->ring[d->avail->idx % d->queue_size] = head;
+  barrier ();
+  d->avail->idx++;
+}
+
+/* Issues queued requests on device D for as long as there are
+   descriptors for them, then notifies the device. */
+static void
+kick (struct virtio_blk *d)
+{
+  bool issued = false;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (!list_empty (&d->queue) && d->free_cnt >= 3)
+    {
+      struct block_request *r = list_entry (list_front (&d->queue),
+                                            struct block_request, elem);
+      if (d->front_op == NULL)
+        {
+          d->front_op = alloc_op (d);
+          if (d->front_op == NULL)
+            break;
+          d->front_op->r = r;
+          d->front_op->issued = 0;
+          d->front_op->parts = 0;
+        }
+
+      issue_part (d, d->front_op);
+      issued = true;
+      if (d->front_op->issued == r->dev_cnt)
+        {
+          list_pop_front (&d->queue);
+          d->front_op = NULL;
+        }
+    }
+
+  if (issued)
+    {
+      barrier ();
+      outw (d->io_base + REG_QUEUE_NOTIFY, 0);
+    }
+}
+
+/* Handles the entries that device D has added to its used ring,
+   completing requests whose parts are all done, then issues more
+   requests into the freed descriptors. */
+static void
+reap (struct virtio_blk *d)
+{
+  while (d->last_used != *(volatile uint16_t *) &d->used->idx)
+    {
+      struct vring_used_elem *e;
+      struct operation *op;
+      struct slot *slot;
+
+      barrier ();
+      e = &d->used->ring[d->last_used % d->queue_size];
+      slot = &d->slots[e->id];
+      op = slot->op;
+      d->last_used++;
+
+      if (slot->status != 0)
+        PANIC ("%s: disk %s failed, sector=%"PRIu64, d->name,
+               op->r->write ? "write" : "read", slot->header.sector);
+      free_chain (d, e->id);
+
+      if (--op->parts == 0 && op->issued == op->r->dev_cnt)
+        {
+          struct block_request *r = op->r;
+          op->r = NULL;
+          block_complete (r);
+        }
+    }
+  kick (d);
+}
+
+/* virtio-blk interrupt handler.  Reading the interrupt status
+   register acknowledges the interrupt. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < device_cnt; i++)
+    {
+      struct virtio_blk *d = &devices[i];
+      if (f->vec_no == d->irq + 0x20u
+          && (inb (d->io_base + REG_ISR) & ISR_QUEUE))
+        reap (d);
+    }
+}
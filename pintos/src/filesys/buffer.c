@@ -1,178 +1,1249 @@
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <debug.h>
 #include "filesys/buffer.h"
 #include "threads/synch.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "devices/block.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
-/* Buffer cache with a maximum capacity of 64 disk blocks */
+/* Default number of blocks in the buffer cache, if not set on the
+   kernel command line with -cache=BLOCKS */
 #define CACHE_BLOCKS 64
 
-struct cache_block cache_blocks[CACHE_BLOCKS];    /* Array of cache_blocks */
+/* Block data lives in pages from the kernel pool, several blocks to a
+   page.  Pages are handed back to the page allocator one at a time
+   when it runs out, down to CACHE_MIN_PAGES. */
+#define CACHE_BLOCKS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+#define CACHE_MIN_PAGES 2
+
+/* Write-behind.  The flusher thread writes back all dirty blocks every
+   FLUSH_PERIOD timer ticks, or sooner once FLUSH_DIRTY_LIMIT blocks
+   are dirty, so that eviction usually finds clean victims. */
+#define FLUSH_PERIOD (TIMER_FREQ / 2)
+#define FLUSH_DIRTY_LIMIT (cache_page_cnt * CACHE_BLOCKS_PER_PAGE / 4)
+
+/* Flushes write dirty sectors in ascending order, as runs of up to
+   FLUSH_RUN_MAX consecutive sectors per transfer. */
+#define FLUSH_RUN_MAX 64
+
+/* Metadata blocks are only evicted to make room for file data while
+   they fill more than METADATA_RESERVE blocks of the cache. */
+#define METADATA_RESERVE (cache_page_cnt * CACHE_BLOCKS_PER_PAGE / 4)
+
+/* 2Q replacement.  Sectors seen once wait in a FIFO holding about a
+   quarter of the cache; only sectors referenced again after falling
+   out of it, as remembered by a ghost queue of half the cache's size,
+   are promoted to the LRU queue.  A long scan therefore only cycles
+   through the FIFO and leaves the LRU queue alone. */
+#define TWOQ_IN_MAX (cache_page_cnt * CACHE_BLOCKS_PER_PAGE / 4)
+#define TWOQ_OUT_MAX (cache_block_cnt / 2)
+
+/* Warm-up.  At shutdown the WARM_UP_MAX most accessed sectors are
+   recorded in CACHE_WARM_UP_SECTOR, and prefetched at the next boot.
+   Hits and misses among the first WARM_UP_WINDOW accesses after boot
+   are counted separately, to measure the benefit. */
+#define WARM_UP_MAGIC 0x4357524d
+#define WARM_UP_MAX 63
+#define WARM_UP_WINDOW 1024
+
+/* Maximum number of sectors waiting to be read ahead.  Requests
+   beyond this are dropped. */
+#define READ_AHEAD_SLOTS 64
+
+/* Most consecutive sectors read ahead or warmed up in one transfer */
+#define PREFETCH_RUN_MAX 8
+
+/* Synchronization.
+
+   The global cache_lock protects the index, the free list, all
+   replacement policy state and the state, pin_cnt, dirty and metadata
+   members of every block.
+   It is never held across disk I/O.
+
+   A block's block_lock protects its data and is held for the length
+   of any disk transfer on it, so threads that hit on a block being
+   read in or written back simply wait on block_lock while other
+   threads keep using the rest of the cache.
+
+   A thread may only acquire a block_lock while it holds a pin on that
+   block, and every pin is dropped under cache_lock after the
+   block_lock is released.  An unpinned block therefore never has its
+   block_lock held, so it is safe to acquire it while holding
+   cache_lock.  The reverse order (cache_lock while holding a pinned
+   block's block_lock) is also allowed. */
+
+struct cache_block *cache_blocks;                 /* Array of cache_blocks */
+size_t cache_block_cnt = CACHE_BLOCKS;            /* Number of elements in cache_blocks */
+size_t cache_page_cnt;                            /* Number of pages of block data still owned */
 struct lock cache_lock;                           /* Lock for cache_block synchronization */
+struct condition cache_unpinned;                  /* Signaled when a block's pin count drops to zero */
 unsigned clock_index;                             /* Current position of the clock hand for clock algorithm */
-size_t cache_miss;                                /* Number of cache misses */
-size_t cache_hit;                                 /* Number of cache hits */
+struct cache_stats cache_stats;                   /* Statistics, except the current sizes */
+size_t cache_dirty_cnt;                           /* Number of dirty cache_blocks */
+size_t cache_metadata_cnt;                        /* Number of metadata cache_blocks */
+size_t cache_access_cnt;                          /* Number of accesses since boot, up to WARM_UP_WINDOW */
+struct hash cache_map;                            /* Index of valid cache_blocks by sector */
+struct list cache_free;                           /* List of CACHE_FREE cache_blocks */
+
+/* A buffer cache replacement policy.  It tracks every block that holds
+   a sector, from insert() until remove(), and picks eviction victims.
+   All functions are called with the global cache lock held. */
+struct cache_policy
+  {
+    const char *name;                               /* Name for -cache-policy */
+    void (*init) (void);                            /* Set up, after the blocks */
+    void (*insert) (struct cache_block *);          /* Block was filled with a sector */
+    void (*access) (struct cache_block *);          /* Block was hit in the cache */
+    void (*remove) (struct cache_block *);          /* Block no longer holds its sector */
+    struct cache_block *(*victim) (bool metadata_ok); /* Unpinned valid block to evict, or NULL;
+                                                         metadata only if METADATA_OK */
+  };
+
+static const struct cache_policy clock_policy;
+static const struct cache_policy twoq_policy;
+
+/* Available policies and the one in use */
+static const struct cache_policy *cache_policies[] = {&clock_policy, &twoq_policy};
+static const struct cache_policy *cache_policy = &twoq_policy;
+
+/* Flush state.  flush_lock serializes flushes, which share the list of
+   blocks to write and the buffer the data of a run is gathered in. */
+static struct lock flush_lock;
+static struct cache_block **flush_blocks;         /* Blocks being flushed, sorted by sector */
+static uint8_t *flush_buffer;                     /* FLUSH_RUN_MAX sectors of data */
+static struct semaphore flush_wanted;             /* Upped when FLUSH_DIRTY_LIMIT is reached */
+
+/* A sector to prefetch at boot */
+struct warm_up_entry
+  {
+    block_sector_t sector;
+    uint32_t type;                  /* enum cache_type of the sector */
+  };
+
+/* On-disk list of sectors to prefetch at boot.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct warm_up_disk
+  {
+    unsigned magic;                 /* WARM_UP_MAGIC */
+    uint32_t cnt;                   /* Number of entries */
+    struct warm_up_entry entries[WARM_UP_MAX];
+  };
+
+/* Search key for cache_map lookups.  Only the sector member is used.
+   Protected by the global cache lock. */
+static struct cache_block cache_key;
+
+/* Queue of sectors for the read-ahead thread, used as a ring buffer */
+static block_sector_t read_ahead_queue[READ_AHEAD_SLOTS];
+static unsigned read_ahead_head;                  /* Number of sectors ever queued */
+static unsigned read_ahead_tail;                  /* Number of sectors ever dequeued */
+static struct lock read_ahead_lock;               /* Lock for the read-ahead queue */
+static struct semaphore read_ahead_ready;         /* Number of sectors in the queue */
 
 static struct cache_block *cache_get_block(void);
-static struct cache_block *cache_check(block_sector_t sector);
+static struct cache_block *cache_lookup(block_sector_t sector);
+static struct cache_block *cache_check(block_sector_t sector, enum cache_type type);
+static void cache_lock_acquire(void);
+static size_t cache_prefetch(block_sector_t sector, size_t cnt, enum cache_type type,
+                             uint8_t *buffer);
+static struct cache_block *cache_hold(struct cache_block *block, enum cache_type type);
+static struct cache_block *cache_claim(block_sector_t sector, enum cache_state state,
+                                       enum cache_type type);
+static struct cache_block *cache_fill(block_sector_t sector, bool read, enum cache_type type);
+static struct cache_block *cache_pin(block_sector_t sector, bool read, enum cache_type type);
+static void cache_tag(struct cache_block *block, enum cache_type type);
+static void cache_drop(struct cache_block *block);
+static void cache_write_back(struct cache_block *block);
+static thread_func cache_flusher;
+static thread_func cache_read_ahead_thread;
+static thread_func cache_warm_up_thread;
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+static int cache_sector_compare(const void *, const void *);
+static int cache_access_compare(const void *, const void *);
+static int warm_up_entry_compare(const void *, const void *);
+
+/* Selects the replacement policy named NAME.  Returns false if there
+   is no such policy.  Must be called before filesys_cache_init(). */
+bool
+cache_set_policy(const char *name)
+{
+  size_t i;
+  for (i = 0; i < sizeof cache_policies / sizeof *cache_policies; i++) {
+    if (!strcmp(cache_policies[i]->name, name)) {
+      cache_policy = cache_policies[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Sets the number of blocks in the buffer cache to BLOCKS, rounded
+   up to a whole number of pages.  Must be called before
+   filesys_cache_init(). */
+void
+cache_set_size(size_t blocks)
+{
+  if (blocks < CACHE_MIN_PAGES * CACHE_BLOCKS_PER_PAGE)
+    blocks = CACHE_MIN_PAGES * CACHE_BLOCKS_PER_PAGE;
+  cache_block_cnt = ROUND_UP(blocks, CACHE_BLOCKS_PER_PAGE);
+}
 
 void
 filesys_cache_init(void)
 {
   lock_init(&cache_lock);
-  clock_index = 0;
-  cache_miss = 0;
-  cache_hit = 0;
+  cond_init(&cache_unpinned);
+  memset(&cache_stats, 0, sizeof cache_stats);
+  cache_dirty_cnt = 0;
+  cache_metadata_cnt = 0;
+  cache_access_cnt = 0;
+
+  if (!hash_init(&cache_map, cache_hash, cache_less, NULL))
+    PANIC("Failed to allocate buffer cache index");
+  list_init(&cache_free);
+
+  cache_block_cnt = ROUND_UP(cache_block_cnt, CACHE_BLOCKS_PER_PAGE);
+  cache_blocks = malloc(cache_block_cnt * sizeof *cache_blocks);
+  if (cache_blocks == NULL)
+    PANIC("Failed to allocate %zu buffer cache blocks", cache_block_cnt);
 
-  int i;
-  for (i = 0; i < CACHE_BLOCKS; i++) {
+  /* Blocks whose page could not be allocated start out retired */
+  size_t i;
+  uint8_t *page = NULL;
+  cache_page_cnt = 0;
+  for (i = 0; i < cache_block_cnt; i++) {
+    if (i % CACHE_BLOCKS_PER_PAGE == 0) {
+      page = palloc_get_page(0);
+      if (page != NULL)
+        cache_page_cnt++;
+    }
     lock_init(&cache_blocks[i].block_lock);
-    cache_blocks[i].valid = false;
+    cache_blocks[i].state = page != NULL ? CACHE_FREE : CACHE_RETIRED;
+    cache_blocks[i].data = page != NULL ? page + (i % CACHE_BLOCKS_PER_PAGE) * BLOCK_SECTOR_SIZE : NULL;
+    cache_blocks[i].pin_cnt = 0;
     cache_blocks[i].dirty = false;
+    cache_blocks[i].metadata = false;
+    if (page != NULL)
+      list_push_back(&cache_free, &cache_blocks[i].list_elem);
+  }
+
+  if (cache_page_cnt < CACHE_MIN_PAGES)
+    PANIC("Failed to allocate buffer cache pages");
+  if (cache_page_cnt * CACHE_BLOCKS_PER_PAGE < cache_block_cnt)
+    printf("Buffer cache: only %zu of %zu blocks allocated\n",
+           cache_page_cnt * CACHE_BLOCKS_PER_PAGE, cache_block_cnt);
+  cache_policy->init();
+
+  lock_init(&flush_lock);
+  sema_init(&flush_wanted, 0);
+  flush_blocks = malloc(cache_block_cnt * sizeof *flush_blocks);
+  flush_buffer = malloc(FLUSH_RUN_MAX * BLOCK_SECTOR_SIZE);
+  if (flush_blocks == NULL || flush_buffer == NULL)
+    PANIC("Failed to allocate buffer cache flush buffers");
+
+  lock_init(&read_ahead_lock);
+  sema_init(&read_ahead_ready, 0);
+  read_ahead_head = 0;
+  read_ahead_tail = 0;
+
+  /* Start the write-behind and read-ahead threads */
+  thread_create("cache_flusher", PRI_DEFAULT, cache_flusher, NULL);
+  thread_create("cache_read_ahead", PRI_DEFAULT, cache_read_ahead_thread, NULL);
+}
+
+/* Returns a hash value for the sector of cache_block E. */
+static unsigned
+cache_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_block *block = hash_entry(e, struct cache_block, hash_elem);
+  return hash_int(block->sector);
+}
+
+/* Returns true if cache_block A has a lower sector than B. */
+static bool
+cache_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  const struct cache_block *block_a = hash_entry(a, struct cache_block, hash_elem);
+  const struct cache_block *block_b = hash_entry(b, struct cache_block, hash_elem);
+  return block_a->sector < block_b->sector;
+}
+
+/* Returns the cache block for SECTOR, or NULL if it is not in
+   the cache.  Does not count as a hit or miss.
+
+   Precondition: Must be holding the global cache lock. */
+static struct cache_block *
+cache_lookup(block_sector_t sector)
+{
+  /* Only valid entries are kept in the index */
+  cache_key.sector = sector;
+  struct hash_elem *e = hash_find(&cache_map, &cache_key.hash_elem);
+  return e != NULL ? hash_entry(e, struct cache_block, hash_elem) : NULL;
+}
+
+/* qsort() comparison of two cache_block pointers by sector. */
+static int
+cache_sector_compare(const void *a_, const void *b_)
+{
+  const struct cache_block *a = *(struct cache_block * const *) a_;
+  const struct cache_block *b = *(struct cache_block * const *) b_;
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Acquires the global cache lock, accounting for any time spent
+   waiting for it. */
+static void
+cache_lock_acquire(void)
+{
+  if (!lock_try_acquire(&cache_lock)) {
+    int64_t start = timer_ticks();
+    lock_acquire(&cache_lock);
+    cache_stats.lock_waits++;
+    cache_stats.lock_wait_ticks += timer_elapsed(start);
   }
 }
 
 /* Checks if block with sector number SECTOR
-   is in the cache.  Returns a pointer to the cache
-   block if it is and NULL otherwise.
+   is in the cache, for an access of TYPE.  Returns a pointer to the
+   cache block if it is and NULL otherwise.
 
    Precondition: Must be holding the global cache lock. */
 static struct cache_block *
-cache_check(block_sector_t sector)
-{
-  int i;
-  for (i = 0; i < CACHE_BLOCKS; i++) {
-    /* We only care if the entry is valid */
-    if (cache_blocks[i].valid) {
-      /* Check if the sector number is the same as the one we are looking for */
-      if (cache_blocks[i].sector == sector) {
-        /* Cache hit.  Increment counter and return block pointer */
-        cache_hit++;
-        return &cache_blocks[i];
-      }
-    }
+cache_check(block_sector_t sector, enum cache_type type)
+{
+  struct cache_block *block = cache_lookup(sector);
+  bool warm_up = cache_access_cnt < WARM_UP_WINDOW;
+
+  if (warm_up)
+    cache_access_cnt++;
+
+  if (block != NULL) {
+    /* Cache hit.  Increment counters and return block pointer */
+    cache_stats.hits++;
+    if (type == CACHE_METADATA)
+      cache_stats.metadata_hits++;
+    else
+      cache_stats.data_hits++;
+    if (warm_up)
+      cache_stats.warm_up_hits++;
+    return block;
   }
   /* We didn't find the entry.
-  Cache miss, increment counter and return null. */
-  cache_miss++;
+  Cache miss, increment counters and return null. */
+  cache_stats.misses++;
+  if (type == CACHE_METADATA)
+    cache_stats.metadata_misses++;
+  else
+    cache_stats.data_misses++;
+  if (warm_up)
+    cache_stats.warm_up_misses++;
   return NULL;
 }
 
+/* Writes BLOCK, which must be valid and dirty, back to disk.  The
+   block is pinned and in CACHE_WRITING for the length of the transfer,
+   so readers and writers of the block wait on its block_lock while the
+   rest of the cache stays usable.
+
+   Precondition: Must be holding the global cache lock.  It is released
+   during the write and held again on return. */
+static void
+cache_write_back(struct cache_block *block)
+{
+  ASSERT(block->state == CACHE_VALID && block->dirty);
+
+  /* Clear dirty before the write, so any change made after we
+     copy the data out marks the block dirty again */
+  block->pin_cnt++;
+  block->state = CACHE_WRITING;
+  block->dirty = false;
+  cache_dirty_cnt--;
+  lock_release(&cache_lock);
+
+  lock_acquire(&block->block_lock);
+  block_write(fs_device, block->sector, block->data);
+
+  cache_lock_acquire();
+  block->state = CACHE_VALID;
+  block->pin_cnt--;
+  lock_release(&block->block_lock);
+  if (block->pin_cnt == 0)
+    cond_signal(&cache_unpinned, &cache_lock);
+}
+
 /* Gets a block to use from the cache.  If not full, just returns
-   an invalid entry.  If it is full, then it evicts using clock
-   algorithm and returns the evicted block. */
+   a free entry.  If it is full, then it evicts the victim chosen by
+   the replacement policy and returns it.  The returned block is free,
+   unpinned and no longer in the index or on the free list.
+
+   Dirty victims are written back first with cache_write_back(), which
+   drops the global cache lock for the duration of the write, and then
+   reconsidered.  If every block is pinned, waits for one to be
+   unpinned.
+
+   Precondition: Must be holding the global cache lock. */
 static struct cache_block *
 cache_get_block(void)
 {
+  struct cache_block *written = NULL;
+
   /* Loop until we find a block to return, in which case
   we will just break via return */
   while (1) {
-    if (!cache_blocks[clock_index].valid) {
-      /* This cache block isn't valid, so we can just return it */
-      return &cache_blocks[clock_index];
-    }
+    if (!list_empty(&cache_free))
+      return list_entry(list_pop_front(&cache_free), struct cache_block, list_elem);
 
-    if (cache_blocks[clock_index].recently_used) {
-      /* Don't evict if the block was recently used */
-      cache_blocks[clock_index].recently_used = false;
+    /* Spare metadata within its reserve */
+    struct cache_block *block = cache_policy->victim(cache_metadata_cnt > METADATA_RESERVE);
+    if (block == NULL && cache_metadata_cnt <= METADATA_RESERVE)
+      block = cache_policy->victim(true);
+    if (block == NULL) {
+      /* Every block is pinned */
+      cond_wait(&cache_unpinned, &cache_lock);
+    } else if (block->dirty) {
+      /* This cache block is dirty, write it back to disk and ask
+      again, since it may have been used in the meantime */
+      cache_write_back(block);
+      cache_stats.dirty_writebacks++;
+      written = block;
     } else {
-      if (cache_blocks[clock_index].dirty) {
-        /* This cache block is dirty, write it back to disk */
-        block_write(fs_device, cache_blocks[clock_index].sector, cache_blocks[clock_index].data);
-        cache_blocks[clock_index].dirty = false;
-      }
-      /* Invalidate the entry so we know we can use it */
-      cache_blocks[clock_index].valid = false;
-
-      return &cache_blocks[clock_index];
+      /* Invalidate the entry and drop it from the index so we know we can use it */
+      cache_drop(block);
+      block->state = CACHE_FREE;
+      cache_stats.evictions++;
+      if (block != written)
+        cache_stats.clean_evictions++;
+      return block;
     }
+  }
+}
 
-    /* Move the clock hand and reset to beginning if it gets too big */
-    clock_index++;
-    if (clock_index == CACHE_BLOCKS) {
-      clock_index = 0;
-    }
+/* Records an access of TYPE to BLOCK.  A block stays metadata once it
+   has been accessed as metadata, until it leaves the cache.
+
+   Precondition: Must be holding the global cache lock. */
+static void
+cache_tag(struct cache_block *block, enum cache_type type)
+{
+  if (type == CACHE_METADATA && !block->metadata) {
+    block->metadata = true;
+    cache_metadata_cnt++;
   }
 }
 
-void
-cache_read_at(block_sector_t sector, void *buffer)
+/* Removes valid BLOCK from the index and the replacement policy.  The
+   caller gives the block its new state.
+
+   Precondition: Must be holding the global cache lock. */
+static void
+cache_drop(struct cache_block *block)
 {
-  /* Acquire the main cache lock */
-  lock_acquire(&cache_lock);
+  cache_policy->remove(block);
+  if (block->metadata) {
+    block->metadata = false;
+    cache_metadata_cnt--;
+  }
+  hash_delete(&cache_map, &block->hash_elem);
+}
 
-  /* Check if the block is in the cache and retrieve it */
-  struct cache_block *block = cache_check(sector);
+/* Pins BLOCK, which is in the cache, for an access of TYPE and returns
+   it with its block_lock held, after any I/O in flight on it has
+   finished.
+
+   Precondition: Must be holding the global cache lock.  It is
+   released before returning. */
+static struct cache_block *
+cache_hold(struct cache_block *block, enum cache_type type)
+{
+  /* Tell the replacement policy and pin it */
+  cache_tag(block, type);
+  cache_policy->access(block);
+  block->access_cnt++;
+  if (block->prefetched) {
+    block->prefetched = false;
+    cache_stats.read_ahead_hits++;
+  }
+  block->pin_cnt++;
 
+  /* Release the main cache lock, then wait for any I/O in flight */
+  lock_release(&cache_lock);
+  lock_acquire(&block->block_lock);
+  return block;
+}
+
+/* Brings SECTOR, which is not in the cache, into a cache block and
+   returns the block pinned and with its block_lock held.  If READ is
+   false, its data is not read from disk, so the caller must overwrite
+   the whole block.  TYPE tags the access.
+
+   The global cache lock is not held during the disk read, so other
+   threads keep hitting in the cache meanwhile.  Threads that look up
+   SECTOR while it is being read in wait on the block_lock.
+
+   Precondition: Must be holding the global cache lock.  It is
+   released before returning. */
+static struct cache_block *
+cache_fill(block_sector_t sector, bool read, enum cache_type type)
+{
+  struct cache_block *block = cache_claim(sector, read ? CACHE_READING : CACHE_VALID, type);
   if (block == NULL) {
-    /* The block wasn't in the cache, get a new one and set it up */
-    block = cache_get_block();
-    block->sector = sector;
-    block->valid = true;
-    block->dirty = false;
-    block_read(fs_device, sector, block->data);
-    block->recently_used = true;
-    memcpy(buffer, block->data, BLOCK_SECTOR_SIZE);
-  } else {
-    /* The block was in the cache, copy into buffer and update recently_used */
-    block->recently_used = true;
-    memcpy(buffer, block->data, BLOCK_SECTOR_SIZE);
+    /* Use the block already in the cache */
+    return cache_hold(cache_lookup(sector), type);
   }
 
-  /* Release the main cache lock */
+  /* Release the main cache lock before going to disk */
   lock_release(&cache_lock);
+  if (read)
+    block_read(fs_device, sector, block->data);
+  return block;
 }
 
-void
-cache_write_at(block_sector_t sector, const void *buffer)
+/* Gets a block for SECTOR, which is not in the cache, and puts it in
+   the index in STATE for an access of TYPE.  Returns the block pinned
+   and with its block_lock held, without reading its data.  Returns a
+   null pointer if another thread brought SECTOR in meanwhile.
+
+   Precondition: Must be holding the global cache lock.  It is held
+   again on return. */
+static struct cache_block *
+cache_claim(block_sector_t sector, enum cache_state state, enum cache_type type)
 {
+  /* Get a new block and set it up */
+  struct cache_block *block = cache_get_block();
+
+  /* Another thread may have brought SECTOR in while cache_get_block()
+  was writing back a victim without the cache lock */
+  block->sector = sector;
+  if (hash_insert(&cache_map, &block->hash_elem) != NULL) {
+    /* Put our block back on the free list */
+    list_push_front(&cache_free, &block->list_elem);
+    return NULL;
+  }
 
+  block->state = state;
+  block->dirty = false;
+  block->pin_cnt = 1;
+  block->access_cnt = 1;
+  block->prefetched = false;
+  cache_tag(block, type);
+  cache_policy->insert(block);
+  /* Block was unpinned, so nobody holds its block_lock */
+  lock_acquire(&block->block_lock);
+  return block;
+}
+
+/* Returns the cache block holding SECTOR, pinned and with its
+   block_lock held, loading it into the cache if necessary.  If READ is
+   false and the sector is not cached, its data is not read from disk,
+   so the caller must overwrite the whole block.  TYPE tags the access.
+   Release with cache_put(). */
+static struct cache_block *
+cache_pin(block_sector_t sector, bool read, enum cache_type type)
+{
   /* Acquire the main cache lock */
-  lock_acquire(&cache_lock);
+  cache_lock_acquire();
 
   /* Check if the block is in the cache and retrieve it */
-  struct cache_block *block = cache_check(sector);
+  struct cache_block *block = cache_check(sector, type);
+  if (block != NULL)
+    return cache_hold(block, type);
 
-  if (block == NULL) {
-    /* The block wasn't in the cache, get a new one and set it up */
-    block = cache_get_block();
-    block->sector = sector;
-    block->valid = true;
-    block->dirty = true;
-    block->recently_used = true;
-    memcpy(block->data, buffer, BLOCK_SECTOR_SIZE);
-  } else {
-    /* The block was in the cache, copy into buffer and update recently_used */
+  /* The block wasn't in the cache */
+  return cache_fill(sector, read, type);
+}
+
+/* Returns the cache block holding SECTOR, reading it in if necessary.
+   The block is pinned and locked for the caller, who may read and
+   modify its data in place until releasing it with cache_put().  A
+   thread must not cache_get() a sector it already holds.  TYPE says
+   whether the sector holds file data or metadata. */
+struct cache_block *
+cache_get(block_sector_t sector, enum cache_type type)
+{
+  return cache_pin(sector, true, type);
+}
+
+/* Releases BLOCK, previously returned by cache_get().  If DIRTY is
+   true, the block's data was modified and must eventually be written
+   back to disk. */
+void
+cache_put(struct cache_block *block, bool dirty)
+{
+  ASSERT(lock_held_by_current_thread(&block->block_lock));
+
+  cache_lock_acquire();
+  if (block->state == CACHE_READING)
+    block->state = CACHE_VALID;
+  if (dirty && !block->dirty) {
     block->dirty = true;
-    block->recently_used = true;
-    memcpy(block->data, buffer, BLOCK_SECTOR_SIZE);
+    if (++cache_dirty_cnt == FLUSH_DIRTY_LIMIT)
+      sema_up(&flush_wanted);
   }
-
-  /* Release the main cache lock */
+  block->pin_cnt--;
+  lock_release(&block->block_lock);
+  if (block->pin_cnt == 0)
+    cond_signal(&cache_unpinned, &cache_lock);
   lock_release(&cache_lock);
 }
 
+void
+cache_read_at(block_sector_t sector, void *buffer, enum cache_type type)
+{
+  struct cache_block *block = cache_pin(sector, true, type);
+  memcpy(buffer, block->data, BLOCK_SECTOR_SIZE);
+  cache_put(block, false);
+}
+
+void
+cache_write_at(block_sector_t sector, const void *buffer, enum cache_type type)
+{
+  struct cache_block *block = cache_pin(sector, false, type);
+  memcpy(block->data, buffer, BLOCK_SECTOR_SIZE);
+  cache_put(block, true);
+}
+
+/* Overwrites SECTOR with BUFFER in the cache, if the sector is cached
+   or on its way in, and returns true.  Returns false if not cached. */
+static bool
+cache_update(block_sector_t sector, const void *buffer, enum cache_type type)
+{
+  cache_lock_acquire();
+  struct cache_block *block = cache_lookup(sector);
+  if (block == NULL) {
+    lock_release(&cache_lock);
+    return false;
+  }
+  cache_hold(block, type);
+  memcpy(block->data, buffer, BLOCK_SECTOR_SIZE);
+  cache_put(block, true);
+  return true;
+}
+
+/* Reads the CNT sectors starting at SECTOR into BUFFER straight from
+   disk, without bringing them into the cache, except that sectors
+   already cached are copied from the cache.  For large transfers that
+   would only push more useful blocks out.  Uncached runs are read with
+   one multi-sector transfer each. */
+void
+cache_read_direct(block_sector_t sector, size_t cnt, void *buffer_, enum cache_type type)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0) {
+    struct cache_block *block = NULL;
+    size_t i;
+
+    /* Find the first cached sector */
+    cache_lock_acquire();
+    for (i = 0; i < cnt; i++)
+      if ((block = cache_lookup(sector + i)) != NULL)
+        break;
+    cache_stats.direct_reads += i;
+    if (block != NULL) {
+      /* The cached copy may be newer than the disk */
+      cache_hold(block, type);
+      memcpy(buffer + i * BLOCK_SECTOR_SIZE, block->data, BLOCK_SECTOR_SIZE);
+      cache_put(block, false);
+    } else
+      lock_release(&cache_lock);
+
+    /* Read the uncached sectors before it */
+    block_read_multiple(fs_device, sector, i, buffer);
+
+    if (block != NULL)
+      i++;
+    sector += i;
+    buffer += i * BLOCK_SECTOR_SIZE;
+    cnt -= i;
+  }
+}
+
+/* Writes the CNT sectors in BUFFER to disk starting at SECTOR, without
+   bringing them into the cache.  Sectors that are cached are updated
+   in the cache instead.  Uncached runs are written with one
+   multi-sector transfer each. */
+void
+cache_write_direct(block_sector_t sector, size_t cnt, const void *buffer_,
+                   enum cache_type type)
+{
+  const uint8_t *buffer = buffer_;
+
+  while (cnt > 0) {
+    struct cache_block *block = NULL;
+    size_t i, j;
+
+    /* Find the first cached sector */
+    cache_lock_acquire();
+    for (i = 0; i < cnt; i++)
+      if ((block = cache_lookup(sector + i)) != NULL)
+        break;
+    cache_stats.direct_writes += i;
+    if (block != NULL) {
+      cache_hold(block, type);
+      memcpy(block->data, buffer + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+      cache_put(block, true);
+    } else
+      lock_release(&cache_lock);
+
+    /* Write the uncached sectors before it */
+    block_write_multiple(fs_device, sector, i, buffer);
+
+    /* A block filled with one of them during the write may hold the old
+    data.  Overwrite it, which leaves it dirty and costs one more write */
+    for (j = 0; j < i; j++)
+      cache_update(sector + j, buffer + j * BLOCK_SECTOR_SIZE, type);
+
+    if (block != NULL)
+      i++;
+    sector += i;
+    buffer += i * BLOCK_SECTOR_SIZE;
+    cnt -= i;
+  }
+}
+
+/* Writes every dirty block back to disk, in order of sector number and
+   coalescing consecutive sectors into multi-sector writes.  Blocks are
+   pinned in CACHE_WRITING meanwhile, but their block_locks are only
+   held long enough to copy their data, so they stay usable. */
 void
 cache_flush(void)
 {
-  /* Acquire the main cache lock */
-  lock_acquire(&cache_lock);
-
-  int i;
-  for (i = 0; i < CACHE_BLOCKS; i++) {
-    lock_acquire(&cache_blocks[i].block_lock);
-    if (cache_blocks[i].valid && cache_blocks[i].dirty) {
-      block_write(fs_device, cache_blocks[i].sector, cache_blocks[i].data);
-      cache_blocks[i].dirty = false;
+  size_t cnt = 0;
+  size_t i, j;
+
+  lock_acquire(&flush_lock);
+
+  /* Claim every dirty block, as cache_write_back() does.  Blocks being
+  read in are clean, and blocks already being written back need not
+  be written twice */
+  cache_lock_acquire();
+  for (i = 0; i < cache_block_cnt; i++) {
+    struct cache_block *block = &cache_blocks[i];
+    if (block->state == CACHE_VALID && block->dirty) {
+      block->pin_cnt++;
+      block->state = CACHE_WRITING;
+      block->dirty = false;
+      cache_dirty_cnt--;
+      flush_blocks[cnt++] = block;
     }
-    lock_release(&cache_blocks[i].block_lock);
   }
+  cache_stats.flushes++;
+  cache_stats.flush_writes += cnt;
+  lock_release(&cache_lock);
 
-  /* Release the main cache lock */
+  qsort(flush_blocks, cnt, sizeof *flush_blocks, cache_sector_compare);
+
+  /* Write each run of consecutive sectors in one transfer.  The data
+  is copied out under each block's block_lock, so a block is never
+  locked while another one is waited on */
+  for (i = 0; i < cnt; i = j) {
+    for (j = i; j < cnt && j - i < FLUSH_RUN_MAX
+                && flush_blocks[j]->sector == flush_blocks[i]->sector + (j - i); j++) {
+      lock_acquire(&flush_blocks[j]->block_lock);
+      memcpy(flush_buffer + (j - i) * BLOCK_SECTOR_SIZE, flush_blocks[j]->data,
+             BLOCK_SECTOR_SIZE);
+      lock_release(&flush_blocks[j]->block_lock);
+    }
+    block_write_multiple(fs_device, flush_blocks[i]->sector, j - i, flush_buffer);
+
+    cache_lock_acquire();
+    size_t k;
+    for (k = i; k < j; k++) {
+      flush_blocks[k]->state = CACHE_VALID;
+      if (--flush_blocks[k]->pin_cnt == 0)
+        cond_signal(&cache_unpinned, &cache_lock);
+    }
+    lock_release(&cache_lock);
+  }
+
+  lock_release(&flush_lock);
+}
+
+/* Returns true if every block in page number PAGE of the cache can be
+   dropped right away: free, or valid, clean and unpinned.
+
+   Precondition: Must be holding the global cache lock. */
+static bool
+cache_page_reclaimable(size_t page)
+{
+  size_t i;
+  for (i = page * CACHE_BLOCKS_PER_PAGE; i < (page + 1) * CACHE_BLOCKS_PER_PAGE; i++) {
+    struct cache_block *block = &cache_blocks[i];
+    if (block->state == CACHE_RETIRED)
+      return false;
+    if (block->state != CACHE_FREE
+        && (block->state != CACHE_VALID || block->pin_cnt > 0 || block->dirty))
+      return false;
+  }
+  return true;
+}
+
+/* Gives up to PAGE_CNT pages of cached data back to the page
+   allocator, dropping the clean blocks they hold, and returns the
+   number of pages freed.  Called by the page allocator when the kernel
+   pool runs out.  Never blocks: returns 0 if the cache is busy,
+   including when the calling thread is itself inside the cache. */
+size_t
+cache_shrink(size_t page_cnt)
+{
+  size_t freed = 0;
+  size_t page;
+
+  if (cache_blocks == NULL || lock_held_by_current_thread(&cache_lock)
+      || !lock_try_acquire(&cache_lock))
+    return 0;
+
+  /* Retire pages from the end of the array first */
+  for (page = cache_block_cnt / CACHE_BLOCKS_PER_PAGE; page-- > 0; ) {
+    if (freed == page_cnt || cache_page_cnt <= CACHE_MIN_PAGES)
+      break;
+    if (!cache_page_reclaimable(page))
+      continue;
+
+    struct cache_block *first = &cache_blocks[page * CACHE_BLOCKS_PER_PAGE];
+    uint8_t *data = first->data;
+    size_t i;
+    for (i = 0; i < CACHE_BLOCKS_PER_PAGE; i++) {
+      if (first[i].state == CACHE_VALID)
+        cache_drop(&first[i]);
+      else
+        list_remove(&first[i].list_elem);
+      first[i].state = CACHE_RETIRED;
+      first[i].data = NULL;
+    }
+    palloc_free_page(data);
+    cache_page_cnt--;
+    freed++;
+  }
+
+  lock_release(&cache_lock);
+  return freed;
+}
+
+/* Write-behind thread started by filesys_cache_init().  Flushes the
+   cache periodically, and early when cache_put() signals that too many
+   blocks are dirty; in between it stays blocked.  Each period first
+   copies changed in-memory inodes into the cache, since their
+   writeback is deferred too. */
+static void
+cache_flusher(void *aux UNUSED)
+{
+  int64_t last_flush = timer_ticks();
+
+  while (1) {
+    int64_t left = FLUSH_PERIOD - timer_elapsed(last_flush);
+    if (left > 0)
+      timer_sema_down(&flush_wanted, left);
+    if (timer_elapsed(last_flush) >= FLUSH_PERIOD) {
+      inode_sync();
+      if (cache_dirty_cnt > 0)
+        cache_flush();
+      last_flush = timer_ticks();
+    } else if (cache_dirty_cnt >= FLUSH_DIRTY_LIMIT) {
+      cache_flush();
+      last_flush = timer_ticks();
+    }
+  }
+}
+
+/* Reads up to CNT, at most PREFETCH_RUN_MAX, consecutive sectors
+   starting at SECTOR into the cache ahead of use, for later accesses
+   of TYPE, with one multi-sector transfer through BUFFER, which must
+   have room for CNT sectors.  Stops at the first sector that is
+   already cached or on its way in.  Returns the number of sectors
+   dealt with, at least 1. */
+static size_t
+cache_prefetch(block_sector_t sector, size_t cnt, enum cache_type type, uint8_t *buffer)
+{
+  struct cache_block *blocks[PREFETCH_RUN_MAX];
+  size_t n = 0;
+  size_t i;
+
+  ASSERT(cnt > 0 && cnt <= PREFETCH_RUN_MAX);
+
+  cache_lock_acquire();
+  while (n < cnt && cache_lookup(sector + n) == NULL) {
+    struct cache_block *block = cache_claim(sector + n, CACHE_READING, type);
+    if (block == NULL)
+      break;
+
+    /* Filling is not an access: the first real access counts as a
+    read-ahead hit */
+    block->access_cnt = 0;
+    block->prefetched = true;
+    cache_stats.read_ahead++;
+    blocks[n++] = block;
+  }
   lock_release(&cache_lock);
+
+  if (n == 0)
+    return 1;
+
+  block_read_multiple(fs_device, sector, n, buffer);
+  for (i = 0; i < n; i++) {
+    memcpy(blocks[i]->data, buffer + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+    cache_put(blocks[i], false);
+  }
+  return n;
+}
+
+/* Queues SECTOR to be read into the cache in the background, if the
+   read-ahead queue has room.  Returns immediately. */
+void
+cache_read_ahead(block_sector_t sector)
+{
+  lock_acquire(&read_ahead_lock);
+  if (read_ahead_head - read_ahead_tail < READ_AHEAD_SLOTS) {
+    read_ahead_queue[read_ahead_head++ % READ_AHEAD_SLOTS] = sector;
+    sema_up(&read_ahead_ready);
+  }
+  lock_release(&read_ahead_lock);
+}
+
+/* Read-ahead thread started by filesys_cache_init().  Reads queued
+   sectors into the cache, without counting them as hits or misses,
+   so that the thread that asked for them later finds them cached or
+   only waits for the read already in flight. */
+static void
+cache_read_ahead_thread(void *aux UNUSED)
+{
+  static uint8_t buffer[PREFETCH_RUN_MAX * BLOCK_SECTOR_SIZE];
+
+  while (1) {
+    sema_down(&read_ahead_ready);
+
+    /* Take the sector at the head of the queue, along with any that
+    directly follow it on disk */
+    lock_acquire(&read_ahead_lock);
+    block_sector_t sector = read_ahead_queue[read_ahead_tail++ % READ_AHEAD_SLOTS];
+    size_t cnt = 1;
+    while (cnt < PREFETCH_RUN_MAX && read_ahead_tail != read_ahead_head
+           && read_ahead_queue[read_ahead_tail % READ_AHEAD_SLOTS] == sector + cnt) {
+      /* Every queued sector was counted in read_ahead_ready */
+      if (!sema_try_down(&read_ahead_ready))
+        NOT_REACHED();
+      read_ahead_tail++;
+      cnt++;
+    }
+    lock_release(&read_ahead_lock);
+
+    size_t i;
+    for (i = 0; i < cnt; )
+      i += cache_prefetch(sector + i, cnt - i, CACHE_DATA, buffer);
+  }
+}
+
+/* qsort() comparison of two cache_block pointers, most accessed
+   first. */
+static int
+cache_access_compare(const void *a_, const void *b_)
+{
+  const struct cache_block *a = *(struct cache_block * const *) a_;
+  const struct cache_block *b = *(struct cache_block * const *) b_;
+  return a->access_cnt > b->access_cnt ? -1 : a->access_cnt < b->access_cnt;
+}
+
+/* qsort() comparison of two warm_up_entry structs by sector. */
+static int
+warm_up_entry_compare(const void *a_, const void *b_)
+{
+  const struct warm_up_entry *a = a_;
+  const struct warm_up_entry *b = b_;
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Records the most accessed sectors in the cache to
+   CACHE_WARM_UP_SECTOR, for cache_warm_up() at the next boot.  Called
+   at shutdown, after the cache has been flushed. */
+void
+cache_save_warm_up(void)
+{
+  struct warm_up_disk *disk;
+  size_t cnt = 0;
+  size_t i;
+
+  ASSERT(sizeof *disk == BLOCK_SECTOR_SIZE);
+  disk = calloc(1, sizeof *disk);
+  if (disk == NULL)
+    return;
+
+  /* The flush list is free for ranking the blocks */
+  lock_acquire(&flush_lock);
+  cache_lock_acquire();
+  for (i = 0; i < cache_block_cnt; i++) {
+    struct cache_block *block = &cache_blocks[i];
+    if (block->state == CACHE_VALID && block->sector != CACHE_WARM_UP_SECTOR)
+      flush_blocks[cnt++] = block;
+  }
+  qsort(flush_blocks, cnt, sizeof *flush_blocks, cache_access_compare);
+
+  disk->magic = WARM_UP_MAGIC;
+  disk->cnt = cnt < WARM_UP_MAX ? cnt : WARM_UP_MAX;
+  for (i = 0; i < disk->cnt; i++) {
+    disk->entries[i].sector = flush_blocks[i]->sector;
+    disk->entries[i].type = flush_blocks[i]->metadata ? CACHE_METADATA : CACHE_DATA;
+  }
+  lock_release(&cache_lock);
+  lock_release(&flush_lock);
+
+  block_write(fs_device, CACHE_WARM_UP_SECTOR, disk);
+  free(disk);
+}
+
+/* Reads the list of sectors saved by cache_save_warm_up() at the last
+   shutdown, if any, and prefetches them into the cache in the
+   background, in ascending sector order. */
+void
+cache_warm_up(void)
+{
+  struct warm_up_disk *disk = malloc(sizeof *disk);
+  if (disk == NULL)
+    return;
+
+  block_read(fs_device, CACHE_WARM_UP_SECTOR, disk);
+  if (disk->magic != WARM_UP_MAGIC || disk->cnt > WARM_UP_MAX) {
+    free(disk);
+    return;
+  }
+  qsort(disk->entries, disk->cnt, sizeof *disk->entries, warm_up_entry_compare);
+
+  if (thread_create("cache_warm_up", PRI_DEFAULT, cache_warm_up_thread, disk) == TID_ERROR)
+    free(disk);
+}
+
+/* Prefetches the sectors listed in warm_up_disk AUX, then frees it. */
+static void
+cache_warm_up_thread(void *aux)
+{
+  static uint8_t buffer[PREFETCH_RUN_MAX * BLOCK_SECTOR_SIZE];
+  struct warm_up_disk *disk = aux;
+  size_t i, cnt;
+
+  for (i = 0; i < disk->cnt; i += cnt) {
+    block_sector_t sector = disk->entries[i].sector;
+    enum cache_type type = disk->entries[i].type == CACHE_METADATA ? CACHE_METADATA : CACHE_DATA;
+
+    /* Take the following entries that are consecutive on disk */
+    for (cnt = 1; cnt < PREFETCH_RUN_MAX && i + cnt < disk->cnt; cnt++)
+      if (disk->entries[i + cnt].sector != sector + cnt
+          || disk->entries[i + cnt].type != disk->entries[i].type)
+        break;
+
+    if (sector + cnt <= block_size(fs_device)) {
+      size_t j;
+      for (j = 0; j < cnt; )
+        j += cache_prefetch(sector + j, cnt - j, type, buffer);
+    }
+  }
+  free(disk);
 }
 
+/* Clock replacement: a hand sweeps the array of blocks, giving every
+   block referenced since the last sweep a second chance. */
+
+static void
+clock_init(void)
+{
+  clock_index = 0;
+}
+
+static void
+clock_touch(struct cache_block *block)
+{
+  block->recently_used = true;
+}
+
+static void
+clock_remove(struct cache_block *block UNUSED)
+{
+}
+
+static struct cache_block *
+clock_victim(bool metadata_ok)
+{
+  size_t scanned;
+
+  /* Two full sweeps without a victim means every block is pinned */
+  for (scanned = 0; scanned < 2 * cache_block_cnt; scanned++) {
+    struct cache_block *block = &cache_blocks[clock_index];
+
+    if (block->state == CACHE_VALID && block->pin_cnt == 0
+        && (metadata_ok || !block->metadata)) {
+      if (!block->recently_used)
+        return block;
+      /* Don't evict if the block was recently used */
+      block->recently_used = false;
+    }
+
+    /* Move the clock hand and reset to beginning if it gets too big */
+    clock_index++;
+    if (clock_index == cache_block_cnt) {
+      clock_index = 0;
+    }
+  }
+  return NULL;
+}
+
+static const struct cache_policy clock_policy = {
+  "clock", clock_init, clock_touch, clock_touch, clock_remove, clock_victim
+};
+
+/* 2Q replacement (Johnson and Shasha).  Blocks are on one of two
+   queues: A1in, a FIFO of sectors referenced once, and Am, an LRU list
+   of sectors referenced again after leaving A1in.  Sectors evicted
+   from A1in are remembered in the A1out ghost queue; a miss on a
+   remembered sector goes straight to Am.  Queues keep the newest block
+   at the front. */
+
+enum twoq_queue
+  {
+    TWOQ_A1IN,                  /* Seen once, FIFO */
+    TWOQ_AM                     /* Seen again, LRU */
+  };
+
+/* A sector recently evicted from A1in */
+struct twoq_ghost
+  {
+    block_sector_t sector;
+    struct list_elem list_elem;       /* Element in twoq_a1out or twoq_ghost_free */
+    struct hash_elem hash_elem;       /* Element in twoq_ghost_map */
+  };
+
+static struct list twoq_a1in;               /* Blocks seen once */
+static size_t twoq_a1in_cnt;                /* Number of blocks in twoq_a1in */
+static struct list twoq_am;                 /* Blocks seen again */
+static struct list twoq_a1out;              /* Ghosts of blocks evicted from A1in */
+static struct list twoq_ghost_free;         /* Unused ghosts */
+static struct hash twoq_ghost_map;          /* Ghosts on twoq_a1out by sector */
+static struct twoq_ghost twoq_ghost_key;    /* Search key for twoq_ghost_map */
+
+static unsigned
+twoq_ghost_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int(hash_entry(e, struct twoq_ghost, hash_elem)->sector);
+}
+
+static bool
+twoq_ghost_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  return hash_entry(a, struct twoq_ghost, hash_elem)->sector
+         < hash_entry(b, struct twoq_ghost, hash_elem)->sector;
+}
+
+static void
+twoq_init(void)
+{
+  list_init(&twoq_a1in);
+  list_init(&twoq_am);
+  list_init(&twoq_a1out);
+  list_init(&twoq_ghost_free);
+  twoq_a1in_cnt = 0;
+
+  size_t ghost_cnt = TWOQ_OUT_MAX;
+  struct twoq_ghost *ghosts = malloc(ghost_cnt * sizeof *ghosts);
+  if (ghosts == NULL || !hash_init(&twoq_ghost_map, twoq_ghost_hash, twoq_ghost_less, NULL))
+    PANIC("Failed to allocate 2Q ghost queue");
+
+  size_t i;
+  for (i = 0; i < ghost_cnt; i++)
+    list_push_back(&twoq_ghost_free, &ghosts[i].list_elem);
+}
+
+static void
+twoq_insert(struct cache_block *block)
+{
+  struct hash_elem *e;
+
+  twoq_ghost_key.sector = block->sector;
+  e = hash_delete(&twoq_ghost_map, &twoq_ghost_key.hash_elem);
+  if (e != NULL) {
+    /* Referenced again after leaving A1in */
+    struct twoq_ghost *ghost = hash_entry(e, struct twoq_ghost, hash_elem);
+    list_remove(&ghost->list_elem);
+    list_push_back(&twoq_ghost_free, &ghost->list_elem);
+    block->queue = TWOQ_AM;
+    list_push_front(&twoq_am, &block->list_elem);
+  } else {
+    block->queue = TWOQ_A1IN;
+    list_push_front(&twoq_a1in, &block->list_elem);
+    twoq_a1in_cnt++;
+  }
+}
+
+static void
+twoq_access(struct cache_block *block)
+{
+  /* Hits on A1in are taken as correlated with the first reference */
+  if (block->queue == TWOQ_AM) {
+    list_remove(&block->list_elem);
+    list_push_front(&twoq_am, &block->list_elem);
+  }
+}
+
+static void
+twoq_remove(struct cache_block *block)
+{
+  list_remove(&block->list_elem);
+  if (block->queue == TWOQ_AM)
+    return;
+  twoq_a1in_cnt--;
+
+  /* Remember the sector, forgetting the oldest ghost if need be */
+  struct twoq_ghost *ghost;
+  if (!list_empty(&twoq_ghost_free))
+    ghost = list_entry(list_pop_front(&twoq_ghost_free), struct twoq_ghost, list_elem);
+  else if (!list_empty(&twoq_a1out)) {
+    ghost = list_entry(list_pop_back(&twoq_a1out), struct twoq_ghost, list_elem);
+    hash_delete(&twoq_ghost_map, &ghost->hash_elem);
+  } else
+    return;
+  ghost->sector = block->sector;
+  hash_insert(&twoq_ghost_map, &ghost->hash_elem);
+  list_push_front(&twoq_a1out, &ghost->list_elem);
+}
+
+/* Returns the oldest unpinned valid block on QUEUE, or NULL.  Skips
+   metadata blocks unless METADATA_OK. */
+static struct cache_block *
+twoq_oldest(struct list *queue, bool metadata_ok)
+{
+  struct list_elem *e;
+  for (e = list_rbegin(queue); e != list_rend(queue); e = list_prev(e)) {
+    struct cache_block *block = list_entry(e, struct cache_block, list_elem);
+    if (block->state == CACHE_VALID && block->pin_cnt == 0
+        && (metadata_ok || !block->metadata))
+      return block;
+  }
+  return NULL;
+}
+
+static struct cache_block *
+twoq_victim(bool metadata_ok)
+{
+  struct cache_block *block;
+
+  /* Take from A1in while it is over its share, else from Am */
+  if (twoq_a1in_cnt > TWOQ_IN_MAX) {
+    block = twoq_oldest(&twoq_a1in, metadata_ok);
+    return block != NULL ? block : twoq_oldest(&twoq_am, metadata_ok);
+  }
+  block = twoq_oldest(&twoq_am, metadata_ok);
+  return block != NULL ? block : twoq_oldest(&twoq_a1in, metadata_ok);
+}
+
+static const struct cache_policy twoq_policy = {
+  "2q", twoq_init, twoq_insert, twoq_access, twoq_remove, twoq_victim
+};
+
 /* Functions below are for testing purpose */
 
 void
@@ -181,14 +1252,24 @@ cache_reset(void)
   cache_flush();
 
   /* Acquire the main cache lock */
-  lock_acquire(&cache_lock);
-  clock_index = 0;
-  cache_miss = 0;
-  cache_hit = 0;
+  cache_lock_acquire();
 
-  int i;
-  for (i = 0; i < CACHE_BLOCKS; i++) {
-    cache_blocks[i].valid = false;
+  /* Warm-up counters only cover the accesses right after boot */
+  unsigned warm_up_hits = cache_stats.warm_up_hits;
+  unsigned warm_up_misses = cache_stats.warm_up_misses;
+  memset(&cache_stats, 0, sizeof cache_stats);
+  cache_stats.warm_up_hits = warm_up_hits;
+  cache_stats.warm_up_misses = warm_up_misses;
+
+  size_t i;
+  for (i = 0; i < cache_block_cnt; i++) {
+    /* Blocks in use or dirtied since the flush stay cached */
+    if (cache_blocks[i].state == CACHE_VALID && cache_blocks[i].pin_cnt == 0
+        && !cache_blocks[i].dirty) {
+      cache_drop(&cache_blocks[i]);
+      cache_blocks[i].state = CACHE_FREE;
+      list_push_back(&cache_free, &cache_blocks[i].list_elem);
+    }
   }
   /* Release the main cache lock */
   lock_release(&cache_lock);
@@ -196,10 +1277,31 @@ cache_reset(void)
 
 int
 get_cache_hit(void) {
-  return cache_hit;
+  return cache_stats.hits;
 }
 
 int
 get_cache_miss(void) {
-  return cache_miss;
+  return cache_stats.misses;
+}
+
+int
+get_cache_warm_up_hit(void) {
+  return cache_stats.warm_up_hits;
+}
+
+int
+get_cache_warm_up_miss(void) {
+  return cache_stats.warm_up_misses;
+}
+
+/* Copies the buffer cache statistics into STATS. */
+void
+get_cache_stats(struct cache_stats *stats) {
+  cache_lock_acquire();
+  *stats = cache_stats;
+  stats->blocks = cache_page_cnt * CACHE_BLOCKS_PER_PAGE;
+  stats->dirty_blocks = cache_dirty_cnt;
+  stats->metadata_blocks = cache_metadata_cnt;
+  lock_release(&cache_lock);
 }
@@ -2,25 +2,68 @@
 #define FILESYS_BUFFER_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <cache-stats.h>
+#include <hash.h>
+#include <list.h>
 #include "devices/block.h"
 #include "filesys/off_t.h"
 #include "threads/synch.h"
 
+/* States of a cache_block.  Changed only while holding the global
+   cache lock.  A block in CACHE_READING or CACHE_WRITING always has
+   a nonzero pin count, so it is never chosen for eviction. */
+enum cache_state {
+    CACHE_FREE,                        /* Holds no sector, ready to be filled */
+    CACHE_READING,                     /* Sector is being read in from disk */
+    CACHE_VALID,                       /* Data is at least as new as the disk */
+    CACHE_WRITING,                     /* Dirty data is being written back to disk */
+    CACHE_RETIRED                      /* Data page given back to the page allocator */
+};
+
+/* What a cached sector holds.  Metadata (inodes, indirect blocks,
+   directories and the free map) is kept in preference to file data. */
+enum cache_type {
+    CACHE_DATA,                        /* File data */
+    CACHE_METADATA                     /* File system metadata */
+};
+
 struct cache_block {
     block_sector_t sector;             /* Sector on disk that this cache is for */
-    uint8_t data[BLOCK_SECTOR_SIZE];   /* Raw data from sector in cache */
-    struct lock block_lock;            /* Lock for synchronization */
-    bool valid;                        /* Valid bit (set false on init, always true after) */
+    uint8_t *data;                     /* Raw data from sector in cache (BLOCK_SECTOR_SIZE bytes) */
+    struct lock block_lock;            /* Held while accessing data or doing disk I/O on it */
+    enum cache_state state;            /* Current state (see above) */
+    int pin_cnt;                       /* Threads using or waiting on this block */
     bool dirty;                        /* Dirty bit */
+    bool metadata;                     /* Accessed as CACHE_METADATA since filled */
+    unsigned access_cnt;               /* Number of accesses since filled */
+    bool prefetched;                   /* Filled ahead of use and not accessed yet */
     bool recently_used;                /* Flag for clock algorithm (evict if false) */
+    int queue;                         /* Queue of the replacement policy the block is on */
+    struct list_elem list_elem;        /* Element in free list or replacement policy queue */
+    struct hash_elem hash_elem;        /* Element in sector -> cache_block index */
 };
 
+void cache_set_size(size_t blocks);
+bool cache_set_policy(const char *name);
 void filesys_cache_init(void);
-void cache_read_at(block_sector_t sector, void *buffer);
-void cache_write_at(block_sector_t sector, const void *buffer);
+void cache_read_at(block_sector_t sector, void *buffer, enum cache_type type);
+void cache_write_at(block_sector_t sector, const void *buffer, enum cache_type type);
+void cache_read_direct(block_sector_t sector, size_t cnt, void *buffer, enum cache_type type);
+void cache_write_direct(block_sector_t sector, size_t cnt, const void *buffer,
+                        enum cache_type type);
+void cache_read_ahead(block_sector_t sector);
+struct cache_block *cache_get(block_sector_t sector, enum cache_type type);
+void cache_put(struct cache_block *block, bool dirty);
 void cache_flush(void);
+void cache_warm_up(void);
+void cache_save_warm_up(void);
 void cache_reset(void);
+size_t cache_shrink(size_t page_cnt);
 int get_cache_hit(void);
 int get_cache_miss(void);
+int get_cache_warm_up_hit(void);
+int get_cache_warm_up_miss(void);
+void get_cache_stats(struct cache_stats *stats);
 
 #endif  /* filesys/buffer.h */
@@ -2,9 +2,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/buffer.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir
@@ -23,6 +25,18 @@ struct dir_entry
 
 static void print_dir_recursive(struct dir *directory, int level);
 
+/* Serializes changes to directories, so that checking that a name
+   is unused and adding it, or finding an entry and erasing it,
+   happen atomically.  Lookups do not take it. */
+static struct lock dir_lock;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  lock_init (&dir_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -41,6 +55,7 @@ dir_open (struct inode *inode)
     {
       dir->inode = inode;
       dir->pos = 0;
+      inode_set_metadata (inode);
       return dir;
     }
   else
@@ -89,28 +104,72 @@ dir_get_inode (struct dir *dir)
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+
+   Entries are compared in place in the buffer cache, one pinned
+   sector at a time.  Only entries that straddle two sectors are
+   copied out. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp)
 {
   struct dir_entry e;
-  size_t ofs;
+  struct cache_block *block = NULL;
+  off_t block_ofs = 0;
+  off_t length;
+  off_t ofs;
+  bool found = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  length = inode_length (dir->inode);
+  for (ofs = 0; ofs + (off_t) sizeof e <= length; ofs += sizeof e)
+    {
+      const struct dir_entry *cur;
+      off_t sector_ofs = ofs % BLOCK_SECTOR_SIZE;
+
+      if (sector_ofs + sizeof e > BLOCK_SECTOR_SIZE)
+        {
+          /* Entry straddles two sectors, so copy it out. */
+          if (block != NULL)
+            {
+              cache_put (block, false);
+              block = NULL;
+            }
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+            break;
+          cur = &e;
+        }
+      else
+        {
+          /* Pin the sector holding the entry if we don't already. */
+          if (block == NULL || block_ofs != ofs - sector_ofs)
+            {
+              if (block != NULL)
+                cache_put (block, false);
+              block_ofs = ofs - sector_ofs;
+              block = inode_get_block (dir->inode, block_ofs);
+              if (block == NULL)
+                break;
+            }
+          cur = (const struct dir_entry *) (block->data + sector_ofs);
+        }
+
+      if (cur->in_use && !strcmp (name, cur->name))
+        {
+          if (ep != NULL)
+            *ep = *cur;
+          if (ofsp != NULL)
+            *ofsp = ofs;
+          found = true;
+          break;
+        }
+    }
+
+  if (block != NULL)
+    cache_put (block, false);
+  return found;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -156,6 +215,8 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  lock_acquire (&dir_lock);
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL)) {
     goto done;
@@ -180,10 +241,14 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 
   if (success) {
 	  struct inode *new_inode = inode_open(inode_sector);
-	  inode_set_parent(new_inode, dir_get_inode(dir));
+	  if (new_inode != NULL) {
+		  inode_set_parent(new_inode, dir_get_inode(dir));
+		  inode_close(new_inode);
+	  }
   }
 
  done:
+  lock_release (&dir_lock);
   return success;
 }
 
@@ -201,6 +266,8 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (&dir_lock);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -220,6 +287,7 @@ dir_remove (struct dir *dir, const char *name)
   success = true;
 
  done:
+  lock_release (&dir_lock);
   inode_close (inode);
   return success;
 }
@@ -1,16 +1,29 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "devices/block.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window limits, in sectors.  The window opens at
+   READ_AHEAD_MIN on the first sequential read, doubles on each
+   further sequential read up to READ_AHEAD_MAX, and closes on any
+   read that does not start where the previous one ended. */
+#define READ_AHEAD_MIN 2
+#define READ_AHEAD_MAX 32
+
 /* An open file. */
 struct file
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Offset where a sequential read would start. */
+    off_t ra_end;               /* End of the range already read ahead. */
+    int ra_window;              /* Read-ahead window in sectors, 0 if random. */
   };
 
+static void file_read_ahead (struct file *, off_t offset, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +36,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -69,10 +85,53 @@ off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
 
+/* Updates FILE's sequential access detection after a read of SIZE
+   bytes at OFFSET, and if the access pattern is sequential, queues
+   the next ra_window sectors past the read to be brought into the
+   buffer cache while the caller works on what it just read. */
+static void
+file_read_ahead (struct file *file, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  if (size == 0)
+    return;
+
+  if (offset == file->ra_next)
+    {
+      /* Sequential: open or grow the window. */
+      file->ra_window *= 2;
+      if (file->ra_window < READ_AHEAD_MIN)
+        file->ra_window = READ_AHEAD_MIN;
+      if (file->ra_window > READ_AHEAD_MAX)
+        file->ra_window = READ_AHEAD_MAX;
+    }
+  else
+    {
+      /* Random: collapse the window. */
+      file->ra_window = 0;
+      file->ra_end = end;
+    }
+  file->ra_next = end;
+
+  if (file->ra_window > 0)
+    {
+      /* Only queue the part of the window not already queued. */
+      off_t start = file->ra_end > end ? file->ra_end : end;
+      off_t limit = end + file->ra_window * BLOCK_SECTOR_SIZE;
+      if (start < limit)
+        {
+          inode_read_ahead (file->inode, start, limit - start);
+          file->ra_end = limit;
+        }
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
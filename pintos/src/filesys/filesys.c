@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/buffer.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -28,6 +29,7 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   /* Initialize the buffer cache */
@@ -35,6 +37,8 @@ filesys_init (bool format)
 
   if (format)
     do_format ();
+  else
+    cache_warm_up ();
 
   struct inode *root_node = inode_open(ROOT_DIR_SECTOR);
   thread_current()->working_dir = dir_open(root_node);
@@ -47,8 +51,10 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
-  /* Flush the buffer cache */
+  /* Flush the buffer cache, and remember what was in it for next time */
+  inode_sync ();
   cache_flush();
+  cache_save_warm_up();
   free_map_close ();
 }
 
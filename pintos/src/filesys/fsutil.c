@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "filesys/buffer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -66,6 +67,31 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Prints buffer cache statistics to the system console. */
+void
+fsutil_cache_stats (char **argv UNUSED)
+{
+  struct cache_stats s;
+
+  get_cache_stats (&s);
+  printf ("Buffer cache: %u blocks, %u dirty, %u metadata\n",
+          s.blocks, s.dirty_blocks, s.metadata_blocks);
+  printf ("  %u hits, %u misses (metadata %u/%u, data %u/%u)\n",
+          s.hits, s.misses, s.metadata_hits, s.metadata_misses,
+          s.data_hits, s.data_misses);
+  printf ("  %u read ahead, %u read-ahead hits\n",
+          s.read_ahead, s.read_ahead_hits);
+  printf ("  %u evictions (%u clean), %u dirty writebacks\n",
+          s.evictions, s.clean_evictions, s.dirty_writebacks);
+  printf ("  %u flushes writing %u sectors\n", s.flushes, s.flush_writes);
+  printf ("  %u direct reads, %u direct writes\n",
+          s.direct_reads, s.direct_writes);
+  printf ("  %u lock waits, %lld ticks waiting\n",
+          s.lock_waits, s.lock_wait_ticks);
+  printf ("  warm-up: %u hits, %u misses\n",
+          s.warm_up_hits, s.warm_up_misses);
+}
+
 /* Extracts a ustar-format tar archive from the scratch block
    device into the Pintos file system. */
 void
@@ -1,11 +1,14 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
+#include <list.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/buffer.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -16,8 +19,31 @@
 /* Number of pointers in a block pointed to by an indirect pointer */
 #define INDIRECT_BLOCK_PTRS 128
 
+/* Largest possible file, in bytes. */
+#define INODE_MAX_LENGTH ((DIRECT_PTRS + INDIRECT_BLOCK_PTRS \
+                           + INDIRECT_BLOCK_PTRS * INDIRECT_BLOCK_PTRS) \
+                          * BLOCK_SECTOR_SIZE)
+
+/* Reads and writes of file data at least this many bytes long move
+   their whole sectors directly between the caller's buffer and the
+   disk, bypassing the buffer cache. */
+#define DIRECT_IO_MIN (16 * BLOCK_SECTOR_SIZE)
+
+/* Most sectors moved by one direct transfer. */
+#define DIRECT_IO_RUN_MAX 64
+
+/* Most newly allocated sectors zeroed by one write. */
+#define ZERO_RUN_MAX 8
+
+/* Zeros for clearing newly allocated sectors. */
+static char zeros[ZERO_RUN_MAX * BLOCK_SECTOR_SIZE];
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   A data or second-level indirect pointer of 0 is a hole: no sector
+   is allocated and its bytes read as zeros.  Growing a file by
+   writing past its end leaves holes, which are filled on first
+   write. */
 struct inode_disk {
   block_sector_t direct_ptrs[DIRECT_PTRS];  /* Array of direct pointers */
   block_sector_t indirect_ptr;              /* Singly indirect pointer */
@@ -35,10 +61,35 @@ struct indirect_block {
 	block_sector_t block_ptrs[INDIRECT_BLOCK_PTRS];
 };
 
+/* In-memory copy of an indirect block. */
+struct map_block
+  {
+    block_sector_t sector;              /* Sector copied, 0 if none. */
+    struct indirect_block ptrs;         /* Copy of its pointers. */
+  };
+
+/* Decoded pointer blocks of an open inode, so that finding the
+   sector for an offset past the direct pointers costs no buffer
+   cache lookups once the pointers are loaded.  Blocks are copied
+   in on first use.  Only inode_extend() and inode_dealloc() change
+   pointer blocks, so the map is discarded around them. */
+struct block_map
+  {
+    struct map_block indirect;          /* Singly indirect block. */
+    struct map_block doubly;            /* Doubly indirect block. */
+    struct map_block second;            /* Last used indirect block
+                                           under the doubly indirect. */
+  };
+
 static bool allocate_indirect_block(struct indirect_block *block, off_t start_index, off_t stop_index);
 static bool inode_alloc(struct inode_disk *inode_d);
 static bool inode_dealloc(struct inode *inode);
+static void block_map_discard (struct inode *);
 static bool inode_extend(struct inode_disk *inode_d, off_t length);
+static bool inode_fill (struct inode *, off_t offset, off_t size);
+static void inode_writeback (struct inode *);
+static size_t direct_run (struct inode *, block_sector_t sector,
+                          off_t offset, off_t size);
 
 /* Allocates indirect pointers in the indirect_block passed in from start_index
    to stop_index, inclusive. Returns true on success and false on failure. */
@@ -62,7 +113,7 @@ allocate_indirect_block(struct indirect_block *block, off_t start_index, off_t s
 
 		/* Zero out indirect block */
 		//block_write(fs_device, block->block_ptrs[i], empty);
-		cache_write_at(block->block_ptrs[i], empty);
+		cache_write_at(block->block_ptrs[i], empty, CACHE_METADATA);
 	}
 	
 	return true;
@@ -80,29 +131,91 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    bool metadata;                      /* Contents are cached as metadata. */
+    struct rwlock rwlock;               /* Held to read data, or to write
+                                           or grow it. */
+    struct lock map_lock;               /* Protects MAP. */
+    struct block_map *map;              /* Decoded pointer blocks, or null. */
+    bool dirty;                         /* DATA changed since last written
+                                           to the buffer cache. */
+    struct list_elem sync_elem;         /* Element in inode_sync()'s list. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Returns how the buffer cache should treat INODE's contents. */
+static inline enum cache_type
+inode_cache_type (const struct inode *inode)
+{
+  return inode->metadata ? CACHE_METADATA : CACHE_DATA;
+}
+
 
 
+/* Returns pointer IDX of the indirect block in SECTOR.  If COPY is
+   non-null, the pointer comes from that in-memory copy, which is
+   first loaded with SECTOR if it holds some other block;
+   otherwise, it is looked up in place in the buffer cache. */
+static block_sector_t
+indirect_lookup (struct map_block *copy, block_sector_t sector, off_t idx)
+{
+  struct cache_block *block;
+  block_sector_t ptr;
+
+  if (copy != NULL)
+    {
+      if (copy->sector != sector)
+        {
+          cache_read_at (sector, &copy->ptrs, CACHE_METADATA);
+          copy->sector = sector;
+        }
+      return copy->ptrs.block_ptrs[idx];
+    }
+
+  block = cache_get (sector, CACHE_METADATA);
+  ptr = ((struct indirect_block *) block->data)->block_ptrs[idx];
+  cache_put (block, false);
+  return ptr;
+}
+
+/* Returns INODE's block map, allocating an empty one if it has
+   none.  Returns a null pointer if memory is short, in which case
+   lookups go through the buffer cache. */
+static struct block_map *
+block_map_get (struct inode *inode)
+{
+  if (inode->map == NULL)
+    inode->map = calloc (1, sizeof *inode->map);
+  return inode->map;
+}
+
+/* Discards INODE's block map, if any, because its pointer blocks
+   are about to change. */
+static void
+block_map_discard (struct inode *inode)
+{
+  free (inode->map);
+  inode->map = NULL;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, or 0 if POS lies in a hole.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+byte_to_sector (struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
 
-  /* TODO: Change this to a buffer cache lookup later */
-  struct inode_disk inode_d = inode->data;
+  const struct inode_disk *inode_d = &inode->data;
+  struct block_map *map;
+  block_sector_t sector;
 
-  if (pos > inode_d.length || pos < 0) {
+  if (pos > inode_d->length || pos < 0) {
 	  return -1;
   }
 
@@ -119,65 +232,80 @@ byte_to_sector (const struct inode *inode, off_t pos)
 
 
   if (block_index < direct_limit) {
-	  return inode_d.direct_ptrs[block_index];
-  } else if (block_index < indirect_limit) {
+	  return inode_d->direct_ptrs[block_index];
+  }
+
+  /* Readers share the block map, so they take turns with it */
+  lock_acquire (&inode->map_lock);
+  map = block_map_get (inode);
+  if (block_index < indirect_limit) {
 	  /* Calculate the index of the direct pointer within the indirect block */
 	  off_t direct_index_in_indirect = block_index - direct_limit;
-	  
-	  /* Declare and allocate indirect block */
-	  struct indirect_block *inode_indirect;
-	  inode_indirect = calloc(1, sizeof(struct indirect_block));
-	  
-	  /* Read the indirect block in from disk (Change this to buffer cache read later) */
-	  //block_read(fs_device, inode_d.indirect_ptr, inode_indirect);
-	  cache_read_at(inode_d.indirect_ptr, inode_indirect);
-	  
-	  /* Get the sector number from the direct pointers array */
-	  block_sector_t sector = inode_indirect->block_ptrs[direct_index_in_indirect];
-	  
-	  /* Free the indirect inode struct */
-	  free(inode_indirect);
-	  /* Return the sector number */
-	  return sector;
+
+	  sector = indirect_lookup (map != NULL ? &map->indirect : NULL,
+	                            inode_d->indirect_ptr, direct_index_in_indirect);
   } else if (block_index < doubly_indirect_limit) {
 	  /* Calculate the index of the indirect pointer within the doubly indirect block */
 	  off_t indirect_index_in_doubly_indirect = (block_index - indirect_limit) / INDIRECT_BLOCK_PTRS;
 	  /* Calculate the index of the direct pointer within the indirect block */
 	  off_t direct_index_in_indirect = (block_index - indirect_limit) % INDIRECT_BLOCK_PTRS;
 
-	  /* Declare and allocate indirect block */
-	  struct indirect_block *inode_indirect;
-	  inode_indirect = calloc(1, sizeof(struct indirect_block));
-
-	  /* Read the doubly indirect block in from disk (Change this to buffer cache read later) */
-	  //block_read(fs_device, inode_d.doubly_indirect_ptr, inode_indirect);
-	  cache_read_at(inode_d.doubly_indirect_ptr, inode_indirect);
-
-	  /* Read the indirect block in from disk (Change this to buffer cache read later) */
-	  //block_read(fs_device, inode_indirect->block_ptrs[indirect_index_in_doubly_indirect], inode_indirect);
-	  cache_read_at(inode_indirect->block_ptrs[indirect_index_in_doubly_indirect], inode_indirect);
-
-	  /* Get the sector number from the direct pointers array */
-	  block_sector_t sector = inode_indirect->block_ptrs[direct_index_in_indirect];
-
-	  /* Free the indirect inode struct */
-	  free(inode_indirect);
-	  /* Return the sector number */
-	  return sector;
+	  /* Look up the indirect block, then the direct pointer in it */
+	  block_sector_t indirect_sector
+	    = indirect_lookup (map != NULL ? &map->doubly : NULL,
+	                       inode_d->doubly_indirect_ptr,
+	                       indirect_index_in_doubly_indirect);
+	  if (indirect_sector == 0) {
+		  /* The whole indirect block is a hole */
+		  sector = 0;
+	  } else {
+		  sector = indirect_lookup (map != NULL ? &map->second : NULL,
+		                            indirect_sector, direct_index_in_indirect);
+	  }
   } else {
-	  return -1;
+	  sector = -1;
   }
+  lock_release (&inode->map_lock);
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, indexed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;    /* Protects OPEN_INODES and the
+                                           OPEN_CNT of each inode. */
+static struct inode open_inodes_key;    /* Key for searching OPEN_INODES. */
+
+/* Serializes inode_sync(), which links inodes through SYNC_ELEM. */
+static struct lock sync_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't create open inode table");
+  lock_init (&open_inodes_lock);
+  lock_init (&sync_lock);
+}
+
+/* Returns a hash value for the sector of inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
 }
 
 /* Returns if an inode is a directory. */
@@ -216,7 +344,7 @@ inode_create (block_sector_t sector, off_t length, bool directory)
   	  success = inode_extend(disk_inode, length) && success;
 
   	  //block_write(fs_device, sector, disk_inode);
-  	  cache_write_at(sector, disk_inode);
+  	  cache_write_at(sector, disk_inode, CACHE_METADATA);
 
       free (disk_inode);
     }
@@ -237,7 +365,7 @@ inode_alloc(struct inode_disk *inode_d) {
 	}
 	/* Zero out indirect block */
 	///block_write(fs_device, inode_d->indirect_ptr, empty);
-	cache_write_at(inode_d->indirect_ptr, empty);
+	cache_write_at(inode_d->indirect_ptr, empty, CACHE_METADATA);
 
 	/* Allocate new doubly indirect block (block of indirect pointers) */
 	if (!free_map_allocate(1, &inode_d->doubly_indirect_ptr)) {
@@ -245,125 +373,156 @@ inode_alloc(struct inode_disk *inode_d) {
 	}
 	/* Zero out indirect block */
 	//block_write(fs_device, inode_d->doubly_indirect_ptr, empty);
-	cache_write_at(inode_d->doubly_indirect_ptr, empty);
+	cache_write_at(inode_d->doubly_indirect_ptr, empty, CACHE_METADATA);
 
 	return true;
 }
 
+/* Releases the data sectors in pointers PTRS[0] through
+   PTRS[CNT - 1], skipping holes and releasing runs of consecutive
+   sectors together. */
+static void
+release_ptrs (const block_sector_t *ptrs, size_t cnt)
+{
+  size_t i = 0;
+
+  while (i < cnt)
+    {
+      size_t j;
+
+      if (ptrs[i] == 0)
+        {
+          i++;
+          continue;
+        }
+      for (j = i + 1; j < cnt && ptrs[j] == ptrs[i] + (j - i); j++)
+        continue;
+      free_map_release (ptrs[i], j - i);
+      i = j;
+    }
+}
+
 /* Deallocates all memory for an inode.  This iterates through
    the multi level indirect blocks and stops according to the
    length of the inode. */
 static bool
 inode_dealloc(struct inode *inode) {
-	/* TODO: Change this to read from disk when we remove data member */
-	struct inode_disk inode_d = inode->data;
-
-	/* Calculate the current number of blocks allocated */
-	size_t curr_num_blocks = bytes_to_sectors(inode_d.length);
+	struct inode_disk *inode_d = &inode->data;
 
 	/* Calculate the current number of blocks allocated (number of blocks to deallocate) */
-	size_t blocks_to_deallocate = bytes_to_sectors(inode_d.length);
+	size_t blocks_to_deallocate = bytes_to_sectors(inode_d->length);
+	size_t cnt;
 
-	/* Bases and limits of direct pointers and indirect pointers */
-	off_t direct_base = 0;
-	off_t direct_limit = direct_base + DIRECT_PTRS;
-	off_t indirect_base = direct_limit;
-	off_t indirect_limit = indirect_base + INDIRECT_BLOCK_PTRS;
+	block_map_discard(inode);
 
-	off_t i;
-	for (i = 0; i < DIRECT_PTRS; i++) {
-		inode_d.direct_ptrs[i] = 0;
-		free_map_release(inode_d.direct_ptrs[i], 1);
+	/* Direct blocks */
+	cnt = blocks_to_deallocate < DIRECT_PTRS ? blocks_to_deallocate : DIRECT_PTRS;
+	release_ptrs(inode_d->direct_ptrs, cnt);
+	blocks_to_deallocate -= cnt;
 
-		blocks_to_deallocate--;
-		if (blocks_to_deallocate <= 0) {
-			return true;
-		}
+	struct indirect_block *inode_indirect = malloc(sizeof(struct indirect_block));
+	struct indirect_block *doubly_indirect = malloc(sizeof(struct indirect_block));
+	if (inode_indirect == NULL || doubly_indirect == NULL) {
+		free(inode_indirect);
+		free(doubly_indirect);
+		return false;
 	}
 
-	/* Check if we need to deallocate the indirect block */
-	if (curr_num_blocks > direct_limit) {
-		struct indirect_block *inode_indirect = calloc(1, sizeof(struct indirect_block));
-
-		/* Read the indirect block in from disk */
-		//block_read(fs_device, inode_d.indirect_ptr, inode_indirect);
-		cache_read_at(inode_d.indirect_ptr, inode_indirect);
-
-		off_t i;
-		for (i = 0; i < INDIRECT_BLOCK_PTRS; i++) {
-			inode_indirect->block_ptrs[i] = 0;
-			/* Deallocate the direct block */
-			free_map_release(inode_indirect->block_ptrs[i], 1);
-
-			blocks_to_deallocate--;
-			if (blocks_to_deallocate <= 0) {
-				/* Deallocate the indirect block */
-				free_map_release(inode_d.indirect_ptr, 1);
-
-				/* Free the indirect_block struct */
-				free(inode_indirect);
+	/* Blocks under the indirect block, then the indirect block */
+	if (blocks_to_deallocate > 0) {
+		cnt = blocks_to_deallocate < INDIRECT_BLOCK_PTRS ? blocks_to_deallocate : INDIRECT_BLOCK_PTRS;
+		cache_read_at(inode_d->indirect_ptr, inode_indirect, CACHE_METADATA);
+		release_ptrs(inode_indirect->block_ptrs, cnt);
+		blocks_to_deallocate -= cnt;
+	}
+	if (inode_d->indirect_ptr != 0) {
+		free_map_release(inode_d->indirect_ptr, 1);
+	}
 
-				return true;
-			}
+	/* Blocks under each (second level) indirect block, then the indirect
+	blocks, then the doubly indirect block */
+	if (blocks_to_deallocate > 0) {
+		cache_read_at(inode_d->doubly_indirect_ptr, doubly_indirect, CACHE_METADATA);
+	}
+	size_t i;
+	for (i = 0; blocks_to_deallocate > 0; i++) {
+		cnt = blocks_to_deallocate < INDIRECT_BLOCK_PTRS ? blocks_to_deallocate : INDIRECT_BLOCK_PTRS;
+		if (doubly_indirect->block_ptrs[i] != 0) {
+			cache_read_at(doubly_indirect->block_ptrs[i], inode_indirect, CACHE_METADATA);
+			release_ptrs(inode_indirect->block_ptrs, cnt);
+			free_map_release(doubly_indirect->block_ptrs[i], 1);
 		}
-		/* Free the indirect_block struct */
-		free(inode_indirect);
+		blocks_to_deallocate -= cnt;
+	}
+	if (inode_d->doubly_indirect_ptr != 0) {
+		free_map_release(inode_d->doubly_indirect_ptr, 1);
 	}
 
-	/* Check if we need to deallocate the doubly indirect block */
-	if (curr_num_blocks > indirect_limit) {
-		struct indirect_block *doubly_indirect = calloc(1, sizeof(struct indirect_block));
-
-		/* Read the indirect block in from disk */
-		//block_read(fs_device, inode_d.doubly_indirect_ptr, doubly_indirect);
-		cache_read_at(inode_d.doubly_indirect_ptr, doubly_indirect);
-
-		off_t i;
-		for (i = 0; i < INDIRECT_BLOCK_PTRS; i++) {
-
-			struct indirect_block *inode_indirect = calloc(1, sizeof(struct indirect_block));
-
-			/* Read the indirect block in from disk */
-			//block_read(fs_device, doubly_indirect->block_ptrs[i], inode_indirect);
-			cache_read_at(doubly_indirect->block_ptrs[i], inode_indirect);
-
-			off_t j;
-			for (j = 0; j < INDIRECT_BLOCK_PTRS; j++) {
-				inode_indirect->block_ptrs[j] = 0;
-				free_map_release(inode_indirect->block_ptrs[j], 1);
-
-				blocks_to_deallocate--;
-				if (blocks_to_deallocate <= 0) {
-					/* Deallocate the (second level) indirect block */
-					free_map_release(doubly_indirect->block_ptrs[i], 1);
-
-					/* Free the indirect_block struct */
-					free(inode_indirect);
-
-					/* Deallocate the doubly indirect block */
-					free_map_release(inode_d.doubly_indirect_ptr, 1);
-					
-					/* Free the doubly indirect block */
-					free(doubly_indirect);
+	free(inode_indirect);
+	free(doubly_indirect);
+	return true;
+}
 
-					return true;
-				}
-			}
+/* Returns the sector following the last of the BLOCKS data
+   sectors of INODE_D, or 0 if it has none. */
+static block_sector_t
+next_data_sector (const struct inode_disk *inode_d, size_t blocks)
+{
+  size_t idx;
 
-			/* Deallocate the (second level) indirect block */
-			free_map_release(doubly_indirect->block_ptrs[i], 1);
+  if (blocks == 0)
+    return 0;
+  idx = blocks - 1;
+  if (idx < DIRECT_PTRS)
+    return inode_d->direct_ptrs[idx] + 1;
+  idx -= DIRECT_PTRS;
+  if (idx < INDIRECT_BLOCK_PTRS)
+    return indirect_lookup (NULL, inode_d->indirect_ptr, idx) + 1;
+  idx -= INDIRECT_BLOCK_PTRS;
+  return indirect_lookup (NULL,
+                          indirect_lookup (NULL, inode_d->doubly_indirect_ptr,
+                                           idx / INDIRECT_BLOCK_PTRS),
+                          idx % INDIRECT_BLOCK_PTRS) + 1;
+}
 
-			/* Free the indirect_block struct */
-			free(inode_indirect);
-		}
-	}
-	
+/* Allocates CNT data sectors, stores their numbers into PTRS, and
+   zeroes them if ZERO is true.  Sectors come in runs of consecutive sectors,
+   starting at *NEXT if it is free, and *NEXT is advanced past the
+   last one, so successive calls lay a growing file out
+   contiguously.  Returns true on success and false on failure. */
+static bool
+allocate_data (block_sector_t *ptrs, size_t cnt, block_sector_t *next,
+               bool zero)
+{
+  while (cnt > 0)
+    {
+      block_sector_t start;
+      size_t run = free_map_allocate_run (cnt, *next, &start);
+      size_t i;
+
+      if (run == 0)
+        return false;
+      for (i = 0; i < run; i++)
+        ptrs[i] = start + i;
+
+      /* Zero the run with multi-sector writes around the cache. */
+      for (i = 0; zero && i < run; i += ZERO_RUN_MAX)
+        cache_write_direct (start + i,
+                            run - i < ZERO_RUN_MAX ? run - i : ZERO_RUN_MAX,
+                            zeros, CACHE_DATA);
+
+      ptrs += run;
+      cnt -= run;
+      *next = start + run;
+    }
   return true;
 }
 
 /* Increases the available length of inode to the argument
-   length provided. Returns true on success and false on 
-   failure. */
+   length provided, allocating and zeroing every new block.
+   Used for the initial length of a new inode; growth by writes
+   leaves holes instead (see inode_fill()).  Returns true on
+   success and false on failure. */
 static bool
 inode_extend(struct inode_disk *inode_d, off_t length)
 {
@@ -382,11 +541,8 @@ inode_extend(struct inode_disk *inode_d, off_t length)
 		return true;
 	}
 
-	static char empty[BLOCK_SECTOR_SIZE];
-
 	/* Make sure that the length arg isn't more than maximum possible size */
-	off_t max_inode_size = (DIRECT_PTRS + INDIRECT_BLOCK_PTRS + INDIRECT_BLOCK_PTRS * DIRECT_PTRS) * BLOCK_SECTOR_SIZE;
-	if (length > max_inode_size || length < inode_d->length) {
+	if (length > INODE_MAX_LENGTH || length < inode_d->length) {
 		return false;
 	}
 
@@ -395,187 +551,306 @@ inode_extend(struct inode_disk *inode_d, off_t length)
 	size_t direct_limit = direct_base + DIRECT_PTRS;
 	size_t indirect_base = direct_limit;
 	size_t indirect_limit = indirect_base + INDIRECT_BLOCK_PTRS;
-	size_t doubly_indirect_base = indirect_limit;
-	size_t doubly_indirect_limit = doubly_indirect_base + INDIRECT_BLOCK_PTRS * INDIRECT_BLOCK_PTRS;
+
+	/* New data goes right after the current last data sector if it can */
+	block_sector_t next = next_data_sector(inode_d, curr_num_blocks);
 
 	/* Check if we need to point more direct blocks to memory (and do it
 	if we need to) */
 	if (curr_num_blocks < direct_limit) {
-		if (new_num_blocks >= direct_limit) {
-			/* New last block uses all direct pointers, allocate them all */
-			unsigned i;
-			for (i = curr_num_blocks; i < direct_limit; i++) {
-				if (!free_map_allocate(1, &inode_d->direct_ptrs[i])) {
-					return false;
-				}
-				//block_write(fs_device, inode_d->direct_ptrs[i], empty);
-				cache_write_at(inode_d->direct_ptrs[i], empty);
-			}
-			/* We need to update curr_num_blocks for future allocations */
-			curr_num_blocks = direct_limit;
-		} else {
-			/* New last block doesn't use all direct pointers */
-			unsigned i;
-			for (i = curr_num_blocks; i < new_num_blocks; i++) {
-				if (!free_map_allocate(1, &inode_d->direct_ptrs[i])) {
-					return false;
-				}
-				//block_write(fs_device, inode_d->direct_ptrs[i], empty);
-				cache_write_at(inode_d->direct_ptrs[i], empty);
-			}
-			/* We don't need to update curr_num_blocks since there will be no more
-			allocation after this point */
+		size_t stop = new_num_blocks < direct_limit ? new_num_blocks : direct_limit;
+
+		if (!allocate_data(&inode_d->direct_ptrs[curr_num_blocks],
+		                   stop - curr_num_blocks, &next, true)) {
+			return false;
 		}
+		curr_num_blocks = stop;
 	}
 
 	/* Check if we need another direct pointer in our indirect block */
-	if (curr_num_blocks < indirect_limit && new_num_blocks > direct_limit) {
-		
+	if (curr_num_blocks < indirect_limit && new_num_blocks > curr_num_blocks) {
+		size_t stop = new_num_blocks < indirect_limit ? new_num_blocks : indirect_limit;
 		struct indirect_block *inode_indirect = calloc(1, sizeof(struct indirect_block));
+		if (inode_indirect == NULL) {
+			return false;
+		}
 
-		/* Initial singly and doubly indirect blocks are pre allocated
+		/* Initial singly and doubly indirect blocks are pre allocated */
 
 		/* Read the indirect block in from disk */
-		//block_read(fs_device, inode_d->indirect_ptr, inode_indirect);
-		cache_read_at(inode_d->indirect_ptr, inode_indirect);
-
-		if (new_num_blocks >= indirect_limit) {
-			/* New last block fills entire indirect block, allocate all */
-			unsigned i;
-			for (i = curr_num_blocks - indirect_base; i < indirect_limit - indirect_base; i++) {
-				if (!free_map_allocate(1, &inode_indirect->block_ptrs[i])) {
-					return false;
-				}
-				//block_write(fs_device, inode_indirect->block_ptrs[i], empty);
-				cache_write_at(inode_indirect->block_ptrs[i], empty);
-			}
-			/* We need to update curr_num_blocks for future allocations */
-			curr_num_blocks = indirect_limit;
-		} else {
-			/* New last block doesn't use all direct pointers in indirect block */
-			unsigned i;
-			for (i = curr_num_blocks - indirect_base; i < new_num_blocks - indirect_base; i++) {
-				if (!free_map_allocate(1, &inode_indirect->block_ptrs[i])) {
-					return false;
-				}
-				//block_write(fs_device, inode_indirect->block_ptrs[i], empty);
-				cache_write_at(inode_indirect->block_ptrs[i], empty);
-			}
-			/* We don't need to update curr_num_blocks since there will be no more
-			allocation after this point */
-		}
+		cache_read_at(inode_d->indirect_ptr, inode_indirect, CACHE_METADATA);
+
+		bool success = allocate_data(&inode_indirect->block_ptrs[curr_num_blocks - indirect_base],
+		                             stop - curr_num_blocks, &next, true);
 
 		/* Write the indirect block back to disk */
-		//block_write(fs_device, inode_d->indirect_ptr, inode_indirect);
-		cache_write_at(inode_d->indirect_ptr, inode_indirect);
+		cache_write_at(inode_d->indirect_ptr, inode_indirect, CACHE_METADATA);
 
 		/* Free the temporary indirect block struct */
 		free(inode_indirect);
+		if (!success) {
+			return false;
+		}
+		curr_num_blocks = stop;
 	}
 
-	/* Check if we need to allocate more in doubly indirect block (either another
-	indirect pointer in the doubly indirect block or a direct pointer in an indirect
-	block pointed at from an indirect pointer in the doubly indirect block) (or both) */
-	/* Precondition: curr_num_blocks >= indirect_limit */
-	if (curr_num_blocks < doubly_indirect_limit && new_num_blocks > indirect_limit) {
-
-		/* Calculate the index of the new last indirect pointer within the doubly indirect block */
-		off_t new_first_level_index = DIV_ROUND_UP(new_num_blocks - indirect_limit, INDIRECT_BLOCK_PTRS) - 1;
-		/* Calculate the index of the new last direct pointer within the indirect block */
-		off_t new_second_level_index = (new_num_blocks - indirect_limit) % INDIRECT_BLOCK_PTRS - 1;
-
-		/* Calculate the index of the current last indirect pointer within the doubly indirect block */
-		off_t curr_first_level_index = DIV_ROUND_UP(curr_num_blocks - indirect_limit, INDIRECT_BLOCK_PTRS) - 1;
-		/* Calculate the index of the current last direct pointer within the indirect block */
-		off_t curr_second_level_index = (curr_num_blocks - indirect_limit) % INDIRECT_BLOCK_PTRS - 1;
-
-		/* Start and end of allocation in first level block of indirect pointers (doubly indirect block) */
-		off_t min_first_level = curr_first_level_index + 1;
-		off_t max_first_level = new_first_level_index;
-
+	/* Fill the indirect blocks under the doubly indirect block one at a
+	time, allocating each when its first pointer is needed */
+	if (new_num_blocks > curr_num_blocks) {
 		struct indirect_block *doubly_indirect = calloc(1, sizeof(struct indirect_block));
+		struct indirect_block *indirect_block = calloc(1, sizeof(struct indirect_block));
+		bool success = doubly_indirect != NULL && indirect_block != NULL;
+
 		/* Read doubly indirect block in from disk */
-		//block_read(fs_device, inode_d->doubly_indirect_ptr, doubly_indirect);
-		cache_read_at(inode_d->doubly_indirect_ptr, doubly_indirect);
-		/* Allocate first level indirect pointers as necessary (in doubly indirect block) */
-		if (!allocate_indirect_block(doubly_indirect, min_first_level, max_first_level)) {
-			return false;
+		if (success) {
+			cache_read_at(inode_d->doubly_indirect_ptr, doubly_indirect, CACHE_METADATA);
 		}
 
-		off_t i;
-		for (i = min_first_level; i <= max_first_level; i++) {
-			/* By default fill whole indirect block with direct block pointers */
-			off_t min = 0;
-			off_t max = INDIRECT_BLOCK_PTRS;
-
-			if (i == min_first_level) {
-				/* First iteration, start at the current block index in indirect block */
-				min = curr_second_level_index + 1;
-			}
-			if (i == max_first_level) {
-				/* Last iteration, end at new last block index in indirect block */
-				max = new_second_level_index;
+		while (success && curr_num_blocks < new_num_blocks) {
+			/* Index of the indirect pointer within the doubly indirect block
+			and of the first new direct pointer within that indirect block */
+			size_t first_level_index = (curr_num_blocks - indirect_limit) / INDIRECT_BLOCK_PTRS;
+			size_t second_level_index = (curr_num_blocks - indirect_limit) % INDIRECT_BLOCK_PTRS;
+			size_t cnt = INDIRECT_BLOCK_PTRS - second_level_index;
+			if (cnt > new_num_blocks - curr_num_blocks) {
+				cnt = new_num_blocks - curr_num_blocks;
 			}
-			
-			struct indirect_block *indirect_block = calloc(1, sizeof(struct indirect_block));
-			/* Read indirect block in from disk */
-			//block_read(fs_device, doubly_indirect->block_ptrs[i], indirect_block);
-			cache_read_at(doubly_indirect->block_ptrs[i], indirect_block);
-			/* Allocate second level direct pointers as necessary (singly indirect block) */
-			if (!allocate_indirect_block(indirect_block, min, max)) {
-				return false;
+
+			/* Allocate the indirect block first if it is new */
+			if (second_level_index == 0
+			    && !allocate_indirect_block(doubly_indirect, first_level_index, first_level_index)) {
+				success = false;
+				break;
 			}
-			/* Write the indirect block out to disk */
-			//block_write(fs_device, doubly_indirect->block_ptrs[i], indirect_block);
-			cache_write_at(doubly_indirect->block_ptrs[i], indirect_block);
-			/* Free the struct */
-			free(indirect_block);
+			block_sector_t indirect_sector = doubly_indirect->block_ptrs[first_level_index];
+
+			/* Allocate second level direct pointers (singly indirect block) */
+			cache_read_at(indirect_sector, indirect_block, CACHE_METADATA);
+			success = allocate_data(&indirect_block->block_ptrs[second_level_index], cnt, &next, true);
+			cache_write_at(indirect_sector, indirect_block, CACHE_METADATA);
+
+			curr_num_blocks += cnt;
 		}
+
 		/* Write the doubly indirect block out to disk */
-		//block_write(fs_device, inode_d->doubly_indirect_ptr, doubly_indirect);
-		cache_write_at(inode_d->doubly_indirect_ptr, doubly_indirect);
-		/* Free the struct */
+		if (doubly_indirect != NULL) {
+			cache_write_at(inode_d->doubly_indirect_ptr, doubly_indirect, CACHE_METADATA);
+		}
+		free(indirect_block);
 		free(doubly_indirect);
+		if (!success) {
+			return false;
+		}
 	}
 
 	inode_d->length = length;
 	return true;
 }
 
+/* Allocates data sectors for the holes among pointers PTRS[FIRST]
+   through PTRS[FIRST + CNT - 1], without zeroing them.  Runs of
+   holes are allocated as runs of sectors placed after *NEXT, and
+   *NEXT follows each pointer in turn.  Sets *CHANGED to true if
+   any pointer is filled.  Returns true if successful, false if
+   the disk is full. */
+static bool
+fill_ptrs (block_sector_t *ptrs, size_t first, size_t cnt,
+           block_sector_t *next, bool *changed)
+{
+  size_t i = first, end = first + cnt;
+
+  while (i < end)
+    {
+      size_t j;
+
+      if (ptrs[i] != 0)
+        {
+          *next = ptrs[i] + 1;
+          i++;
+          continue;
+        }
+      for (j = i + 1; j < end && ptrs[j] == 0; j++)
+        continue;
+      *changed = true;
+      if (!allocate_data (&ptrs[i], j - i, next, false))
+        return false;
+      i = j;
+    }
+  return true;
+}
+
+/* Allocates sectors for the holes in the blocks of INODE that hold
+   the SIZE bytes starting at OFFSET, which must lie within INODE's
+   length.  The caller is about to write those bytes, so only a
+   hole that they cover in part, at either end, is zeroed.
+   Blocks are filled in order, so if the disk fills up, the blocks
+   allocated are a prefix of the range.  Returns true if
+   successful, false if the disk is full or memory is short. */
+static bool
+inode_fill (struct inode *inode, off_t offset, off_t size)
+{
+  struct inode_disk *inode_d = &inode->data;
+  size_t idx = offset / BLOCK_SECTOR_SIZE;
+  size_t end = DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE);
+  off_t last_ofs = (end - 1) * BLOCK_SECTOR_SIZE;
+  bool first_hole, last_hole;
+  block_sector_t next = 0;
+  struct indirect_block *ib = NULL, *doubly = NULL;
+  bool changed = false;
+  bool success = true;
+
+  ASSERT (offset >= 0 && size > 0);
+  ASSERT (offset + size <= inode_length (inode));
+
+  first_hole = (offset % BLOCK_SECTOR_SIZE != 0 || size < BLOCK_SECTOR_SIZE)
+               && byte_to_sector (inode, offset) == 0;
+  last_hole = end - 1 > idx && (offset + size) % BLOCK_SECTOR_SIZE != 0
+              && byte_to_sector (inode, last_ofs) == 0;
+  if (idx > 0)
+    {
+      block_sector_t prev = byte_to_sector (inode,
+                                            (idx - 1) * BLOCK_SECTOR_SIZE);
+      if (prev != 0)
+        next = prev + 1;
+    }
+  block_map_discard (inode);
+
+  /* Direct pointers, kept in the inode itself. */
+  if (idx < DIRECT_PTRS)
+    {
+      size_t stop = end < DIRECT_PTRS ? end : DIRECT_PTRS;
+      success = fill_ptrs (inode_d->direct_ptrs, idx, stop - idx, &next,
+                           &changed);
+      if (changed)
+        inode->dirty = true;
+      idx = stop;
+    }
+
+  ib = malloc (sizeof *ib);
+  if (ib == NULL)
+    success = false;
+
+  /* Pointers in the indirect block. */
+  if (success && idx < end && idx < DIRECT_PTRS + INDIRECT_BLOCK_PTRS)
+    {
+      size_t base = DIRECT_PTRS;
+      size_t stop = end < base + INDIRECT_BLOCK_PTRS
+                    ? end : base + INDIRECT_BLOCK_PTRS;
+      bool ib_changed = false;
+
+      cache_read_at (inode_d->indirect_ptr, ib, CACHE_METADATA);
+      success = fill_ptrs (ib->block_ptrs, idx - base, stop - idx, &next,
+                           &ib_changed);
+      if (ib_changed)
+        cache_write_at (inode_d->indirect_ptr, ib, CACHE_METADATA);
+      idx = stop;
+    }
+
+  /* Pointers in the indirect blocks under the doubly indirect
+     block, allocating any indirect block that is a hole. */
+  if (success && idx < end)
+    {
+      bool doubly_changed = false;
+
+      doubly = malloc (sizeof *doubly);
+      if (doubly == NULL)
+        success = false;
+      else
+        cache_read_at (inode_d->doubly_indirect_ptr, doubly, CACHE_METADATA);
+
+      while (success && idx < end)
+        {
+          size_t f = (idx - DIRECT_PTRS - INDIRECT_BLOCK_PTRS)
+                     / INDIRECT_BLOCK_PTRS;
+          size_t base = (DIRECT_PTRS + INDIRECT_BLOCK_PTRS
+                         + f * INDIRECT_BLOCK_PTRS);
+          size_t stop = end < base + INDIRECT_BLOCK_PTRS
+                        ? end : base + INDIRECT_BLOCK_PTRS;
+          bool ib_changed = false;
+
+          if (doubly->block_ptrs[f] == 0)
+            {
+              if (!allocate_indirect_block (doubly, f, f))
+                {
+                  success = false;
+                  break;
+                }
+              doubly_changed = true;
+            }
+          cache_read_at (doubly->block_ptrs[f], ib, CACHE_METADATA);
+          success = fill_ptrs (ib->block_ptrs, idx - base, stop - idx, &next,
+                               &ib_changed);
+          if (ib_changed)
+            cache_write_at (doubly->block_ptrs[f], ib, CACHE_METADATA);
+          idx = stop;
+        }
+      if (doubly_changed)
+        cache_write_at (inode_d->doubly_indirect_ptr, doubly, CACHE_METADATA);
+    }
+  free (ib);
+  free (doubly);
+
+  /* Zero the partly written holes that were filled. */
+  if (first_hole)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0)
+        cache_write_at (sector, zeros, inode_cache_type (inode));
+    }
+  if (last_hole)
+    {
+      block_sector_t sector = byte_to_sector (inode, last_ofs);
+      if (sector != 0)
+        cache_write_at (sector, zeros, inode_cache_type (inode));
+    }
+  return success;
+}
+
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  open_inodes_key.sector = sector;
+  e = hash_find (&open_inodes, &open_inodes_key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
-        {
-          inode_reopen (inode);
-          return inode;
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  Reading the inode while still holding the lock
+     keeps others from finding it half initialized. */
   inode->sector = sector;
+  hash_insert (&open_inodes, &inode->elem);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->metadata = false;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->map_lock);
+  inode->map = NULL;
+  inode->dirty = false;
   //block_read (fs_device, inode->sector, &inode->data);
-  cache_read_at(inode->sector, &inode->data);
+  cache_read_at(inode->sector, &inode->data, CACHE_METADATA);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -584,7 +859,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -601,16 +880,28 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode)
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Release resources if this was the last opener.  A changed
+     inode is written back before it leaves the table, so that an
+     inode_open() racing with us either finds it or reads the
+     up-to-date copy from the cache. */
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      if (!inode->removed)
+        inode_writeback (inode);
+      hash_delete (&open_inodes, &inode->elem);
+    }
+  lock_release (&open_inodes_lock);
 
+  if (last)
+    {
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
@@ -619,10 +910,69 @@ inode_close (struct inode *inode)
 		  inode_dealloc(inode);
         }
 
+      block_map_discard (inode);
       free (inode);
     }
 }
 
+/* Writes INODE's in-memory inode_disk to the buffer cache if it
+   has changed.  Growing a file changes its length, and filling
+   holes may change its direct pointers, but neither writes the
+   inode out right away, so that a series of appends rewrites its
+   sector only once.  The caller must hold INODE's lock or be its
+   last opener. */
+static void
+inode_writeback (struct inode *inode)
+{
+  if (inode->dirty)
+    {
+      cache_write_at (inode->sector, &inode->data, CACHE_METADATA);
+      inode->dirty = false;
+    }
+}
+
+/* Writes every changed open inode to the buffer cache, from where
+   the next cache flush writes it to disk.  Called by the cache's
+   flusher and when the file system shuts down.
+
+   The changed inodes are collected, and kept open, under
+   OPEN_INODES_LOCK, but written back after releasing it, so that
+   waiting for one inode's writer does not hold up every
+   inode_open() and inode_close() in the meantime. */
+void
+inode_sync (void)
+{
+  struct list dirty;
+  struct hash_iterator i;
+
+  lock_acquire (&sync_lock);
+  list_init (&dirty);
+
+  lock_acquire (&open_inodes_lock);
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i))
+    {
+      struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+      if (inode->dirty)
+        {
+          inode->open_cnt++;
+          list_push_back (&dirty, &inode->sync_elem);
+        }
+    }
+  lock_release (&open_inodes_lock);
+
+  while (!list_empty (&dirty))
+    {
+      struct inode *inode = list_entry (list_pop_front (&dirty),
+                                        struct inode, sync_elem);
+      rwlock_acquire_read (&inode->rwlock);
+      inode_writeback (inode);
+      rwlock_release_read (&inode->rwlock);
+      inode_close (inode);
+    }
+  lock_release (&sync_lock);
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void
@@ -640,8 +990,9 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  bool direct = size >= DIRECT_IO_MIN && !inode->metadata;
 
+  rwlock_acquire_read (&inode->rwlock);
   while (size > 0)
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -658,25 +1009,31 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == 0)
+        {
+          /* A hole reads as zeros. */
+          memset (buffer + bytes_read, 0, chunk_size);
+        }
+      else if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
           /* Read full sector directly into caller's buffer. */
           //block_read (fs_device, sector_idx, buffer + bytes_read);
-          cache_read_at(sector_idx, buffer + bytes_read);
+          if (direct)
+            {
+              /* Read as many sectors as are consecutive on disk. */
+              size_t cnt = direct_run (inode, sector_idx, offset, size);
+              cache_read_direct (sector_idx, cnt, buffer + bytes_read, CACHE_DATA);
+              chunk_size = cnt * BLOCK_SECTOR_SIZE;
+            }
+          else
+            cache_read_at(sector_idx, buffer + bytes_read, inode_cache_type (inode));
         }
       else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          //block_read (fs_device, sector_idx, bounce);
-          cache_read_at(sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          /* Partially copy out of the cached sector in place. */
+          struct cache_block *block = cache_get (sector_idx, inode_cache_type (inode));
+          memcpy (buffer + bytes_read, block->data + sector_ofs, chunk_size);
+          cache_put (block, false);
         }
 
       /* Advance. */
@@ -684,42 +1041,121 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
 
+/* Returns the number of whole sectors, at most DIRECT_IO_RUN_MAX,
+   that INODE holds in consecutive disk sectors starting at SECTOR,
+   which holds the sector-aligned byte OFFSET, and that lie within
+   both the SIZE bytes being transferred and INODE's length. */
+static size_t
+direct_run (struct inode *inode, block_sector_t sector,
+            off_t offset, off_t size)
+{
+  off_t left = inode_length (inode) - offset;
+  size_t cnt = 1;
+
+  if (size < left)
+    left = size;
+  while (cnt < DIRECT_IO_RUN_MAX
+         && (off_t) (cnt + 1) * BLOCK_SECTOR_SIZE <= left
+         && byte_to_sector (inode, offset + cnt * BLOCK_SECTOR_SIZE)
+            == sector + cnt)
+    cnt++;
+  return cnt;
+}
+
+/* Returns the buffer cache block holding the sector of INODE that
+   contains byte offset OFFSET, pinned for in-place access, or a null
+   pointer if OFFSET is at or past the end of INODE.  A hole is
+   allocated and zeroed first; if that fails, returns a null
+   pointer.  The caller must release the block with cache_put(). */
+struct cache_block *
+inode_get_block (struct inode *inode, off_t offset)
+{
+  block_sector_t sector;
+
+  if (offset < 0 || offset >= inode_length (inode))
+    return NULL;
+  rwlock_acquire_read (&inode->rwlock);
+  sector = byte_to_sector (inode, offset);
+  rwlock_release_read (&inode->rwlock);
+  if (sector == 0)
+    {
+      /* Check again, since someone may fill it first. */
+      rwlock_acquire_write (&inode->rwlock);
+      sector = byte_to_sector (inode, offset);
+      if (sector == 0 && inode_fill (inode, offset, 1))
+        sector = byte_to_sector (inode, offset);
+      rwlock_release_write (&inode->rwlock);
+      if (sector == 0)
+        return NULL;
+    }
+  return cache_get (sector, inode_cache_type (inode));
+}
+
+/* Queues the sectors holding the SIZE bytes of INODE starting at
+   OFFSET to be read into the buffer cache in the background.  Bytes
+   past the end of INODE and holes are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+
+  /* Start at the beginning of the sector containing OFFSET. */
+  offset -= offset % BLOCK_SECTOR_SIZE;
+  rwlock_acquire_read (&inode->rwlock);
+  for (; offset < end; offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+  rwlock_release_read (&inode->rwlock);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   Returns the number of bytes actually written.  A write past
+   end of file extends the inode, and any range it skips over
+   becomes a hole that reads as zeros without taking up disk
+   space.  Fewer than SIZE bytes are written only if writes are
+   denied, the file would grow too large, or the disk is full, in
+   which case the inode grows only as far as was written. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
-
-  if (inode->deny_write_cnt)
+  bool direct = size >= DIRECT_IO_MIN && !inode->metadata;
+  off_t start = offset;
+  off_t old_length;
+
+  /* Writers hold the inode exclusively, since growing it changes
+     its length and pointers under readers. */
+  rwlock_acquire_write (&inode->rwlock);
+  if (inode->deny_write_cnt) {
+    rwlock_release_write (&inode->rwlock);
     return 0;
+  }
 
-  /* TODO: Change this to a buffer cache lookup later */
-  struct inode_disk inode_d = inode->data;
-
-  /* The new length is greater than current length, extend it */
-  if (byte_to_sector(inode, offset + size - 1) == -1) {
-    /* Extend the length of the inode */
-    if (!inode_extend(&inode->data, offset + size)) {
+  /* The new length is greater than current length, extend it.
+     The new blocks are holes until written below. */
+  old_length = inode_length (inode);
+  if (offset + size > old_length) {
+    if (offset + size > INODE_MAX_LENGTH) {
+      rwlock_release_write (&inode->rwlock);
       return 0;
     }
 
+    /* The inode_disk is written back later (see inode_sync()) */
     inode->data.length = offset + size;
-
-    /* Write the inode_disk back to disk */
-    //block_write(fs_device, inode->sector, &inode->data);
-    cache_write_at(inode->sector, &inode->data);
+    inode->dirty = true;
   }
 
   while (size > 0)
@@ -728,6 +1164,17 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
+      if (sector_idx == 0)
+        {
+          /* Fill the holes in the rest of the write at once, so
+             they are laid out contiguously.  If the disk is full,
+             write as far as blocks were allocated. */
+          inode_fill (inode, offset, size);
+          sector_idx = byte_to_sector (inode, offset);
+          if (sector_idx == 0)
+            break;
+        }
+
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
@@ -742,30 +1189,23 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
         {
           /* Write full sector directly to disk. */
           //block_write(fs_device, sector_idx, buffer + bytes_written);
-          cache_write_at(sector_idx, buffer + bytes_written);
+          if (direct)
+            {
+              /* Write as many sectors as are consecutive on disk. */
+              size_t cnt = direct_run (inode, sector_idx, offset, size);
+              cache_write_direct (sector_idx, cnt, buffer + bytes_written, CACHE_DATA);
+              chunk_size = cnt * BLOCK_SECTOR_SIZE;
+            }
+          else
+            cache_write_at(sector_idx, buffer + bytes_written, inode_cache_type (inode));
         }
       else
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) {
-            //block_read (fs_device, sector_idx, bounce);
-        	cache_read_at(sector_idx, bounce);
-          } else {
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          }
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          //block_write (fs_device, sector_idx, bounce);
-          cache_write_at(sector_idx, bounce);
+          /* The sector contains data before or after the chunk
+             we're writing, so modify the cached sector in place. */
+          struct cache_block *block = cache_get (sector_idx, inode_cache_type (inode));
+          memcpy (block->data + sector_ofs, buffer + bytes_written, chunk_size);
+          cache_put (block, true);
         }
 
       /* Advance. */
@@ -773,7 +1213,14 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* If the disk filled up partway, the file only grew as far as
+     was actually written. */
+  if (inode_length (inode) > old_length
+      && inode_length (inode) > start + bytes_written)
+    inode->data.length = (start + bytes_written > old_length
+                          ? start + bytes_written : old_length);
+  rwlock_release_write (&inode->rwlock);
 
   return bytes_written;
 }
@@ -783,8 +1230,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode)
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -793,9 +1242,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode)
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -811,21 +1262,32 @@ inode_removed (struct inode *inode) {
 	return inode->removed;
 }
 
+/* Marks the contents of INODE, e.g. a directory or the free map,
+   as file system metadata, which the buffer cache keeps in
+   preference to file data. */
+void
+inode_set_metadata (struct inode *inode)
+{
+  inode->metadata = true;
+}
+
 /* Set dest_inode's data disk_node parent directory to parent_inode. */
 void
 inode_set_parent(struct inode *dest_inode, const struct inode *parent_inode) 
 {
+	rwlock_acquire_write (&dest_inode->rwlock);
 	dest_inode->data.parent_node = parent_inode->sector;
-
-	//block_write(fs_device, dest_inode->sector, &dest_inode->data);
+	dest_inode->dirty = true;
+	rwlock_release_write (&dest_inode->rwlock);
 }
 
 void
 inode_set_disknode_directory(struct inode *inode, bool is_dir)
 {
+	rwlock_acquire_write (&inode->rwlock);
 	inode->data.directory = is_dir;
-
-	//block_write(fs_device, inode->sector, &inode->data);
+	inode->dirty = true;
+	rwlock_release_write (&inode->rwlock);
 }
 
 block_sector_t
@@ -6,6 +6,7 @@
 #include "devices/block.h"
 
 struct bitmap;
+struct cache_block;
 
 void inode_init (void);
 bool inode_create (block_sector_t, off_t, bool);
@@ -13,8 +14,11 @@ struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
+void inode_sync (void);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t offset, off_t size);
+struct cache_block *inode_get_block (struct inode *, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
@@ -22,6 +26,7 @@ off_t inode_length (const struct inode *);
 
 bool inode_removed (struct inode *);
 bool inode_is_dir (struct inode *);
+void inode_set_metadata (struct inode *);
 block_sector_t inode_get_parent(struct inode *);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,31 @@
+#ifndef __LIB_BLOCK_STATS_H
+#define __LIB_BLOCK_STATS_H
+
+#include <stdint.h>
+
+/* Number of buckets in a latency histogram.  Bucket I counts
+   requests that took from 2**I up to 2**(I+1) CPU cycles; the
+   last bucket also takes everything slower. */
+#define BLOCK_LATENCY_BUCKETS 40
+
+/* Block device statistics, as returned by the get_block_stats
+   system call.  Counters run from boot.  Latencies are in CPU
+   time stamp counter cycles, from submission of a request to
+   its completion, so they include time spent queued. */
+struct block_stats
+  {
+    uint64_t read_cnt;            /* Sectors read. */
+    uint64_t write_cnt;           /* Sectors written. */
+    uint64_t read_bytes;          /* Bytes read. */
+    uint64_t write_bytes;         /* Bytes written. */
+    uint64_t requests;            /* Requests completed. */
+    uint64_t merges;              /* Requests merged into others. */
+    uint64_t latency_sum;         /* Total latency of all requests. */
+    uint64_t latency_max;         /* Largest latency of one request. */
+    unsigned queue_depth;         /* Requests outstanding now. */
+    unsigned max_queue_depth;     /* Most requests ever outstanding. */
+    uint64_t latency_hist[BLOCK_LATENCY_BUCKETS];   /* Requests by log2
+                                                       of latency. */
+  };
+
+#endif /* lib/block-stats.h */
@@ -0,0 +1,35 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+#include <stdint.h>
+
+/* Buffer cache statistics, as returned by the get_cache_stats system
+   call.  Counters run from boot or the last cache_reset(), except
+   the warm-up ones, which cover the first accesses after boot. */
+struct cache_stats
+  {
+    unsigned hits;                /* Accesses to cached sectors. */
+    unsigned misses;              /* Accesses that had to fill a block. */
+    unsigned metadata_hits;       /* Hits on metadata accesses. */
+    unsigned metadata_misses;     /* Misses on metadata accesses. */
+    unsigned data_hits;           /* Hits on file data accesses. */
+    unsigned data_misses;         /* Misses on file data accesses. */
+    unsigned read_ahead;          /* Sectors prefetched, including warm-up. */
+    unsigned read_ahead_hits;     /* Prefetched sectors accessed later. */
+    unsigned evictions;           /* Blocks evicted to make room. */
+    unsigned clean_evictions;     /* Evicted blocks that were clean. */
+    unsigned dirty_writebacks;    /* Dirty blocks written back for eviction. */
+    unsigned flushes;             /* Calls to cache_flush(). */
+    unsigned flush_writes;        /* Sectors written back by flushes. */
+    unsigned direct_reads;        /* Sectors read bypassing the cache. */
+    unsigned direct_writes;       /* Sectors written bypassing the cache. */
+    unsigned lock_waits;          /* Contended cache lock acquisitions. */
+    int64_t lock_wait_ticks;      /* Timer ticks spent waiting for it. */
+    unsigned warm_up_hits;        /* Hits among the first accesses. */
+    unsigned warm_up_misses;      /* Misses among the first accesses. */
+    unsigned blocks;              /* Blocks in the cache now. */
+    unsigned dirty_blocks;        /* Dirty blocks now. */
+    unsigned metadata_blocks;     /* Metadata blocks now. */
+  };
+
+#endif /* lib/cache-stats.h */
@@ -24,6 +24,10 @@ enum
     SYS_CACHE_RESET,            /* Resets buffer cache */
     SYS_GET_CACHE_HIT,              /* Returns current cache hits */
     SYS_GET_CACHE_MISS,             /* Returns current cache misses */
+    SYS_GET_CACHE_WARM_UP_HIT,      /* Returns cache hits right after boot */
+    SYS_GET_CACHE_WARM_UP_MISS,     /* Returns cache misses right after boot */
+    SYS_GET_CACHE_STATS,            /* Copies out all cache statistics */
+    SYS_GET_BLOCK_STATS,            /* Copies out a block device's statistics */
 
     /* Project 3 and optionally project 4. */
     SYS_MMAP,                   /* Map a file into memory. */
@@ -206,3 +206,27 @@ get_cache_miss(void)
 {
   return syscall0(SYS_GET_CACHE_MISS);
 }
+
+int
+get_cache_warm_up_hit(void)
+{
+  return syscall0(SYS_GET_CACHE_WARM_UP_HIT);
+}
+
+int
+get_cache_warm_up_miss(void)
+{
+  return syscall0(SYS_GET_CACHE_WARM_UP_MISS);
+}
+
+void
+get_cache_stats(struct cache_stats *stats)
+{
+  syscall1(SYS_GET_CACHE_STATS, stats);
+}
+
+bool
+get_block_stats(const char *device, struct block_stats *stats)
+{
+  return syscall2(SYS_GET_BLOCK_STATS, device, stats);
+}
@@ -2,6 +2,8 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <block-stats.h>
+#include <cache-stats.h>
 #include <debug.h>
 
 /* Process identifier. */
@@ -37,6 +39,10 @@ int practice (int i);
 void cache_reset (void);
 int get_cache_hit (void);
 int get_cache_miss (void);
+int get_cache_warm_up_hit (void);
+int get_cache_warm_up_miss (void);
+void get_cache_stats (struct cache_stats *);
+bool get_block_stats (const char *device, struct block_stats *);
 
 /* Project 3 and optionally project 4. */
 mapid_t mmap (int fd, void *addr);
@@ -0,0 +1,89 @@
+/* Test the buffer cache statistics by reading a file sequentially
+   from a cold cache and checking that read-ahead was counted. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define BLOCK_COUNT 32
+
+const char *file_name = "stats";
+char buf[BLOCK_SIZE];
+
+static void read_bytes(int fd);
+
+/* Read file */
+static void
+read_bytes(int f)
+{
+  int i = 0;
+  size_t ret_val;
+  for (; i < BLOCK_COUNT; i++) {
+    ret_val = read (f, buf, BLOCK_SIZE);
+    if (ret_val != BLOCK_SIZE)
+      fail ("read %zu bytes in \"%s\" returned %zu",
+            BLOCK_SIZE, file_name, ret_val);
+  }
+}
+
+void
+test_main(void)
+{
+  struct cache_stats before, after;
+  int fd;
+  size_t i;
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  /* Create input file */
+  msg ("make \"%s\"", file_name);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  for (i=0; i < BLOCK_COUNT; i++) {
+    size_t ret_val;
+    ret_val = write (fd, buf, BLOCK_SIZE);
+      if (ret_val != BLOCK_SIZE)
+        fail ("write %zu bytes in \"%s\" returned %zu",
+              BLOCK_SIZE, file_name, ret_val);
+    }
+
+  close (fd);
+  msg ("close \"%s\"", file_name);
+
+  /* Reset cache, so that the file has to come from disk */
+  cache_reset();
+  msg ("reset buffer");
+  get_cache_stats(&before);
+
+  /* Read it sequentially, which should start read-ahead */
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  read_bytes(fd);
+
+  close (fd);
+  msg ("close \"%s\"", file_name);
+  get_cache_stats(&after);
+
+  if (after.misses <= before.misses)
+    fail ("no misses counted reading a cold file");
+  msg ("Counted misses on cold read");
+
+  if (after.read_ahead <= before.read_ahead)
+    fail ("no sectors read ahead during sequential read");
+  msg ("Read ahead during sequential read");
+
+  if (after.read_ahead_hits <= before.read_ahead_hits)
+    fail ("no hits on sectors read ahead");
+  msg ("Hit sectors read ahead");
+
+  /* Every read-ahead hit is a hit too */
+  if (after.hits - before.hits < after.read_ahead_hits - before.read_ahead_hits)
+    fail ("%u hits but %u read-ahead hits",
+          after.hits - before.hits,
+          after.read_ahead_hits - before.read_ahead_hits);
+  msg ("Counted read-ahead hits as hits");
+
+  remove("stats");
+}
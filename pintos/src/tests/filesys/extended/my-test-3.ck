@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(my-test-3) begin
+(my-test-3) make "stats"
+(my-test-3) create "stats"
+(my-test-3) open "stats"
+(my-test-3) close "stats"
+(my-test-3) reset buffer
+(my-test-3) open "stats"
+(my-test-3) close "stats"
+(my-test-3) Counted misses on cold read
+(my-test-3) Read ahead during sequential read
+(my-test-3) Hit sectors read ahead
+(my-test-3) Counted read-ahead hits as hits
+(my-test-3) end
+EOF
+pass;
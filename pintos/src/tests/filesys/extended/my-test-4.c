@@ -0,0 +1,108 @@
+/* Test the cache warm-up counters, which only count the accesses
+   in a window right after boot. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define BLOCK_COUNT 32
+
+/* Accesses counted by the warm-up counters after boot, and a
+   number of times to read the file that surely makes more. */
+#define WARM_UP_WINDOW 1024
+#define PASS_COUNT 40
+
+const char *file_name = "warm";
+char buf[BLOCK_SIZE];
+
+static void read_bytes(int fd);
+
+/* Read file */
+static void
+read_bytes(int f)
+{
+  int i = 0;
+  size_t ret_val;
+  for (; i < BLOCK_COUNT; i++) {
+    ret_val = read (f, buf, BLOCK_SIZE);
+    if (ret_val != BLOCK_SIZE)
+      fail ("read %zu bytes in \"%s\" returned %zu",
+            BLOCK_SIZE, file_name, ret_val);
+  }
+}
+
+void
+test_main(void)
+{
+  struct cache_stats stats;
+  int fd;
+  size_t i;
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  /* Booting and loading this program were accesses in the window */
+  int first_hit = get_cache_warm_up_hit();
+  int first_miss = get_cache_warm_up_miss();
+  if (first_hit + first_miss <= 0)
+    fail ("no warm-up accesses counted since boot");
+  msg ("Counted warm-up accesses since boot");
+
+  /* Create input file */
+  msg ("make \"%s\"", file_name);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  for (i=0; i < BLOCK_COUNT; i++) {
+    size_t ret_val;
+    ret_val = write (fd, buf, BLOCK_SIZE);
+      if (ret_val != BLOCK_SIZE)
+        fail ("write %zu bytes in \"%s\" returned %zu",
+              BLOCK_SIZE, file_name, ret_val);
+    }
+
+  close (fd);
+  msg ("close \"%s\"", file_name);
+
+  /* Resetting the cache leaves the warm-up counters alone */
+  int reset_hit = get_cache_warm_up_hit();
+  int reset_miss = get_cache_warm_up_miss();
+  cache_reset();
+  msg ("reset buffer");
+  get_cache_stats(&stats);
+  if ((int) stats.warm_up_hits < reset_hit
+      || (int) stats.warm_up_misses < reset_miss)
+    fail ("reset cleared the warm-up counters");
+  msg ("Kept warm-up counters across reset");
+
+  /* Read the file until the window is surely over */
+  for (i = 0; i < PASS_COUNT; i++) {
+    if ((fd = open (file_name)) <= 1)
+      fail ("open \"%s\"", file_name);
+    read_bytes(fd);
+    close (fd);
+  }
+  msg ("read \"%s\" %d times", file_name, PASS_COUNT);
+
+  int second_hit = get_cache_warm_up_hit();
+  int second_miss = get_cache_warm_up_miss();
+  if (second_hit < first_hit || second_miss < first_miss)
+    fail ("warm-up counters went backwards");
+  if (second_hit + second_miss > WARM_UP_WINDOW)
+    fail ("%d warm-up accesses counted, more than the window of %d",
+          second_hit + second_miss, WARM_UP_WINDOW);
+  msg ("Counted no more than the warm-up window");
+
+  /* Once the window is over, the counters stop moving */
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  read_bytes(fd);
+  close (fd);
+  msg ("close \"%s\"", file_name);
+  if (get_cache_warm_up_hit() != second_hit
+      || get_cache_warm_up_miss() != second_miss)
+    fail ("warm-up counters moved after the window");
+  msg ("Stopped counting after the warm-up window");
+
+  remove("warm");
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(my-test-4) begin
+(my-test-4) Counted warm-up accesses since boot
+(my-test-4) make "warm"
+(my-test-4) create "warm"
+(my-test-4) open "warm"
+(my-test-4) close "warm"
+(my-test-4) reset buffer
+(my-test-4) Kept warm-up counters across reset
+(my-test-4) read "warm" 40 times
+(my-test-4) Counted no more than the warm-up window
+(my-test-4) open "warm"
+(my-test-4) close "warm"
+(my-test-4) Stopped counting after the warm-up window
+(my-test-4) end
+EOF
+pass;
@@ -0,0 +1,80 @@
+/* Test the block device statistics by writing a file and checking
+   the counters of the file system device. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define BLOCK_COUNT 32
+
+const char *file_name = "blocks";
+char buf[BLOCK_SIZE * BLOCK_COUNT];
+
+static uint64_t hist_total(const struct block_stats *);
+
+void
+test_main(void)
+{
+  struct block_stats before, after;
+  uint64_t sectors;
+  int fd;
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (!get_block_stats ("nosuchdev", &before),
+         "get_block_stats \"nosuchdev\" fails");
+  CHECK (get_block_stats ("filesys", &before),
+         "get_block_stats \"filesys\"");
+
+  /* Write the file in one go, then flush the cache so that
+     everything written has reached the device */
+  msg ("make \"%s\"", file_name);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  if (write (fd, buf, sizeof buf) != (int) sizeof buf)
+    fail ("write %zu bytes in \"%s\" failed", sizeof buf, file_name);
+  close (fd);
+  msg ("close \"%s\"", file_name);
+  cache_reset();
+  msg ("reset buffer");
+
+  CHECK (get_block_stats ("filesys", &after),
+         "get_block_stats \"filesys\"");
+
+  sectors = after.write_cnt - before.write_cnt;
+  if (sectors < BLOCK_COUNT)
+    fail ("%llu sectors written, expected at least %d",
+          sectors, BLOCK_COUNT);
+  msg ("Counted the sectors written");
+
+  if (after.write_bytes - before.write_bytes != sectors * BLOCK_SIZE)
+    fail ("%llu bytes written for %llu sectors",
+          after.write_bytes - before.write_bytes, sectors);
+  msg ("Counted the bytes written");
+
+  if (after.requests <= before.requests)
+    fail ("no requests completed");
+  msg ("Counted the requests");
+
+  /* Every completed request lands in one histogram bucket */
+  if (hist_total (&after) != after.requests)
+    fail ("%llu requests in latency histogram, %llu completed",
+          hist_total (&after), after.requests);
+  msg ("Latency histogram covers every request");
+
+  remove("blocks");
+}
+
+/* Returns the number of requests in STATS's latency histogram. */
+static uint64_t
+hist_total(const struct block_stats *stats)
+{
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+    total += stats->latency_hist[i];
+  return total;
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(my-test-5) begin
+(my-test-5) get_block_stats "nosuchdev" fails
+(my-test-5) get_block_stats "filesys"
+(my-test-5) make "blocks"
+(my-test-5) create "blocks"
+(my-test-5) open "blocks"
+(my-test-5) close "blocks"
+(my-test-5) reset buffer
+(my-test-5) get_block_stats "filesys"
+(my-test-5) Counted the sectors written
+(my-test-5) Counted the bytes written
+(my-test-5) Counted the requests
+(my-test-5) Latency histogram covers every request
+(my-test-5) end
+EOF
+pass;
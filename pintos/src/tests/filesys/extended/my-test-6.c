@@ -0,0 +1,74 @@
+/* Test sparse files by writing past the end of an empty file and
+   checking that the hole reads as zeros without being written. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define HOLE_SIZE (128 * BLOCK_SIZE)
+
+const char *file_name = "sparse";
+char buf[BLOCK_SIZE];
+char zeros[BLOCK_SIZE];
+char check[BLOCK_SIZE];
+
+void
+test_main(void)
+{
+  struct block_stats before, after;
+  uint64_t sectors;
+  int fd;
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  msg ("make \"%s\"", file_name);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  /* Write one block past a hole, flushing the cache before and
+     after so that the device sees exactly what the write cost */
+  cache_reset();
+  CHECK (get_block_stats ("filesys", &before),
+         "get_block_stats \"filesys\"");
+  seek (fd, HOLE_SIZE);
+  if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+    fail ("write %d bytes at %d in \"%s\" failed",
+          BLOCK_SIZE, HOLE_SIZE, file_name);
+  msg ("write past hole in \"%s\"", file_name);
+  cache_reset();
+  CHECK (get_block_stats ("filesys", &after),
+         "get_block_stats \"filesys\"");
+
+  if (filesize (fd) != HOLE_SIZE + BLOCK_SIZE)
+    fail ("size of \"%s\" is %d, expected %d",
+          file_name, filesize (fd), HOLE_SIZE + BLOCK_SIZE);
+  msg ("File size covers the hole");
+
+  /* Only the data, its pointers and the free map were written,
+     not the hole */
+  sectors = after.write_cnt - before.write_cnt;
+  if (sectors >= HOLE_SIZE / BLOCK_SIZE)
+    fail ("%llu sectors written for a one-block write", sectors);
+  msg ("Hole was not written to disk");
+
+  seek (fd, HOLE_SIZE / 2);
+  if (read (fd, check, BLOCK_SIZE) != BLOCK_SIZE)
+    fail ("read in hole of \"%s\" failed", file_name);
+  if (memcmp (check, zeros, BLOCK_SIZE))
+    fail ("hole in \"%s\" is not zero", file_name);
+  msg ("Hole reads as zeros");
+
+  seek (fd, HOLE_SIZE);
+  if (read (fd, check, BLOCK_SIZE) != BLOCK_SIZE)
+    fail ("read after hole of \"%s\" failed", file_name);
+  if (memcmp (check, buf, BLOCK_SIZE))
+    fail ("data after hole in \"%s\" is wrong", file_name);
+  msg ("Data after hole reads back");
+
+  close (fd);
+  msg ("close \"%s\"", file_name);
+  remove("sparse");
+}
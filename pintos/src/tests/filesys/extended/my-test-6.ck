@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(my-test-6) begin
+(my-test-6) make "sparse"
+(my-test-6) create "sparse"
+(my-test-6) open "sparse"
+(my-test-6) get_block_stats "filesys"
+(my-test-6) write past hole in "sparse"
+(my-test-6) get_block_stats "filesys"
+(my-test-6) File size covers the hole
+(my-test-6) Hole was not written to disk
+(my-test-6) Hole reads as zeros
+(my-test-6) Data after hole reads back
+(my-test-6) close "sparse"
+(my-test-6) end
+EOF
+pass;
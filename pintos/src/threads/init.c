@@ -34,6 +34,9 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
+#include "filesys/buffer.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -123,6 +126,8 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  virtio_blk_init ();
+  ramdisk_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -247,6 +252,20 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_set_size (atoi (value));
+      else if (!strcmp (name, "-cache"))
+        cache_set_size (atoi (value));
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (!cache_set_policy (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-iosched"))
+        {
+          if (!block_set_default_scheduler (value))
+            PANIC ("unknown I/O scheduler `%s' (use -h for help)", value);
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -315,6 +334,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"cache-stats", 1, fsutil_cache_stats},
 #endif
       {NULL, 0, NULL},
     };
@@ -361,6 +381,7 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  cache-stats        Print buffer cache statistics.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -373,6 +394,11 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=SECTORS   Create a RAM disk \"ram0\" of SECTORS sectors.\n"
+          "  -cache=BLOCKS      Use BLOCKS sectors of RAM for the buffer cache.\n"
+          "  -cache-policy=NAME Replace cached sectors by NAME: 2q (default) or clock.\n"
+          "  -iosched=NAME      Order disk requests by NAME: deadline (default),\n"
+          "                     cscan or none.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -63,9 +63,6 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
-/* Global lock on file system for concurrency */
-struct lock file_sys_lock;
-
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -100,8 +97,6 @@ thread_init (void)
   list_init (&ready_list);
   list_init (&all_list);
 
-  lock_init (&file_sys_lock);
-
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
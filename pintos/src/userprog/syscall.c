@@ -6,6 +6,7 @@
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
+#include "devices/block.h"
 #include "devices/shutdown.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
@@ -59,7 +60,6 @@ syscall_handler (struct intr_frame *f UNUSED)
 		} else {
 				validate_string(&f->eax, (char *)args[1]);
 
-				lock_acquire (&file_sys_lock);
 				if (args[0] == SYS_CREATE) {
           /* New File. */
           if (strlen((char *)args[1]) > NAME_MAX) {
@@ -79,21 +79,16 @@ syscall_handler (struct intr_frame *f UNUSED)
 						f->eax = filesys_create((char *)args[1], 0, true);
 					}
 				}
-				lock_release (&file_sys_lock);
 		}
 	} else if (args[0] == SYS_REMOVE) {
-		lock_acquire (&file_sys_lock);
 		f->eax = filesys_remove((char *) args[1]);
-		lock_release (&file_sys_lock);
 	} else if (args[0] == SYS_OPEN) {
 		if (args[1] == NULL) {
 			f->eax = -1;
 		} else {
 			validate_string(&f->eax, (char *)args[1]);
 
-			lock_acquire (&file_sys_lock);
 			struct file *file = filesys_open((char *) args[1]);
-			lock_release (&file_sys_lock);
 			if (file == NULL) {
 				f->eax = -1;
 			}
@@ -132,13 +127,22 @@ syscall_handler (struct intr_frame *f UNUSED)
     f->eax = get_cache_hit();
   } else if (args[0] == SYS_GET_CACHE_MISS) {
     f->eax = get_cache_miss();
+  } else if (args[0] == SYS_GET_CACHE_WARM_UP_HIT) {
+    f->eax = get_cache_warm_up_hit();
+  } else if (args[0] == SYS_GET_CACHE_WARM_UP_MISS) {
+    f->eax = get_cache_warm_up_miss();
+  } else if (args[0] == SYS_GET_CACHE_STATS) {
+    validate_pointer(&f->eax, (void *) args[1], sizeof (struct cache_stats));
+    get_cache_stats((struct cache_stats *) args[1]);
+  } else if (args[0] == SYS_GET_BLOCK_STATS) {
+    validate_string(&f->eax, (char *) args[1]);
+    validate_pointer(&f->eax, (void *) args[2], sizeof (struct block_stats));
+    f->eax = block_get_stats((char *) args[1], (struct block_stats *) args[2]);
   }
   /* File syscalls with file as input */
   if (args[0] == SYS_FILESIZE) {
   	struct file *file = fd_to_file(args[1]);
-  	lock_acquire (&file_sys_lock);
   	f->eax = file_length(file);
-  	lock_release (&file_sys_lock);
   } else if (args[0] == SYS_READ) {
 	    validate_pointer(&f->eax, (void *) args[2], (size_t) args[3]);
 
@@ -158,9 +162,7 @@ syscall_handler (struct intr_frame *f UNUSED)
         if (file == NULL) {
     	    f->eax = -1;
         } else {
-	        lock_acquire (&file_sys_lock);
 	        f->eax = file_read(file, (void *) args[2], (off_t) args[3]);
-	        lock_release (&file_sys_lock);
   	    }
   } else if (args[0] == SYS_WRITE) {
 		if (args[1] <= 0 || args[1] > thread_current()->fd_count) {
@@ -181,9 +183,7 @@ syscall_handler (struct intr_frame *f UNUSED)
       if (file == NULL || inode_is_dir(file_get_inode(file))) {
 				f->eax = -1;
 			} else {
-				lock_acquire (&file_sys_lock);
 				f->eax = file_write(file, (void *) args[2], (off_t) args[3]);
-				lock_release (&file_sys_lock);
 			}
 		}
   } else if (args[0] == SYS_SEEK) {
@@ -201,9 +201,7 @@ syscall_handler (struct intr_frame *f UNUSED)
 	  	thread_exit ();
   	}
 
-  	lock_acquire (&file_sys_lock);
   	file_seek(file, (off_t) args[2]);
-  	lock_release (&file_sys_lock);
 
   } else if (args[0] == SYS_TELL) {
     struct file *file = fd_to_file(args[1]);